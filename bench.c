@@ -0,0 +1,314 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "coord.h"
+#include "interface.h"
+#include "noise.h"
+#include "physics.h"
+#include "pressure_sensor.h"
+#include "sensors.h"
+#include "sim-common.h"
+#include "simd.h"
+
+/* Times the filter's entry points on their own, without the simulator.  The
+ * rocket sits on the pad and the sensors report it there, with noise, on
+ * the same schedule sim uses: the accelerometer every tick, the gyroscope
+ * every other tick and the slow sensors ten times a second.  Results go to
+ * stdout as CSV, or JSON with --json, one row per particle count and entry
+ * point; "cycle" covers every call made in one tick.  With --adaptive the
+ * per-particle figures are against the starting particle count. */
+
+static const double DELTA_T_SECONDS = 0.001;
+
+static const unsigned default_counts[] = { 1000, 10000, 50000 };
+
+enum stage {
+	STAGE_ACCELEROMETER,
+	STAGE_GYROSCOPE,
+	STAGE_PRESSURE,
+	STAGE_MAGNETOMETER,
+	STAGE_GPS,
+	STAGE_TICK,
+	/* one whole tick's worth of calls */
+	STAGE_CYCLE,
+	STAGES
+};
+
+static const char *const stage_names[STAGES] = {
+	[STAGE_ACCELEROMETER] = "accelerometer",
+	[STAGE_GYROSCOPE] = "gyroscope",
+	[STAGE_PRESSURE] = "pressure",
+	[STAGE_MAGNETOMETER] = "magnetometer",
+	[STAGE_GPS] = "gps",
+	[STAGE_TICK] = "tick",
+	[STAGE_CYCLE] = "cycle",
+};
+
+/* Latencies in nanoseconds of every timed call to one stage */
+struct samples {
+	uint64_t *ns;
+	unsigned count;
+};
+
+static struct samples samples[STAGES];
+static unsigned iteration;
+static bool timing;
+static struct noise_stream sensor_noise;
+static struct gravity_field pad_gravity;
+
+double current_timestamp(void)
+{
+	return iteration * DELTA_T_SECONDS;
+}
+
+void ignite(bool go)
+{
+	(void) go;
+}
+
+void drogue_chute(bool go)
+{
+	(void) go;
+}
+
+void main_chute(bool go)
+{
+	(void) go;
+}
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void record(enum stage stage, uint64_t start)
+{
+	uint64_t end = now();
+	if(timing)
+		samples[stage].ns[samples[stage].count++] = end - start;
+}
+
+#define TIMED(stage, call) do { \
+	uint64_t start = now(); \
+	call; \
+	record(stage, start); \
+} while(0)
+
+static double noisy(double value)
+{
+	double n;
+	noise_gaussian(&sensor_noise, &n, 1, 1.0);
+	return value + n;
+}
+
+static uint16_t quantize(double value)
+{
+	if(value < 0)
+		return 0;
+	if(value > 0xfff)
+		return 0xfff;
+	return lround(value);
+}
+
+static vec3_i quantize_vec(vec3 value)
+{
+	return (vec3_i) {
+		quantize(noisy(value.x)),
+		quantize(noisy(value.y)),
+		quantize(noisy(value.z)),
+	};
+}
+
+static vec3 noisy_vec(vec3 value)
+{
+	return (vec3) { noisy(value.x), noisy(value.y), noisy(value.z) };
+}
+
+static void run(struct rocket_state *pad, unsigned iterations, unsigned warmup)
+{
+	accelerometer_d acc = accelerometer_measurement(&pad_gravity, pad);
+	vec3 gyro = gyroscope_measurement(pad);
+	vec3 mag = magnetometer_measurement(pad);
+	double pressure = pressure_measurement(pad);
+
+	for(iteration = 0; iteration < warmup + iterations; ++iteration)
+	{
+		accelerometer_i acc_i = {
+			quantize(noisy(acc.x)),
+			quantize(noisy(acc.y)),
+			quantize(noisy(acc.z)),
+			quantize(noisy(acc.q)),
+		};
+		vec3_i gyro_i = quantize_vec(gyro);
+		vec3_i mag_i = quantize_vec(mag);
+		unsigned pressure_i = quantize(noisy(pressure));
+		vec3 gps_pos = noisy_vec(pad->pos), gps_vel = noisy_vec(pad->vel);
+
+		timing = iteration >= warmup;
+		uint64_t start = now();
+		TIMED(STAGE_ACCELEROMETER, accelerometer_sensor(acc_i));
+		if(iteration % 2 == 0)
+			TIMED(STAGE_GYROSCOPE, gyroscope_sensor(gyro_i));
+		if(iteration % 100 == 0)
+			TIMED(STAGE_PRESSURE, pressure_sensor(pressure_i));
+		if(iteration % 100 == 25)
+			TIMED(STAGE_MAGNETOMETER, magnetometer_sensor(mag_i));
+		if(iteration % 100 == 50)
+			TIMED(STAGE_GPS, gps_sensor(gps_pos, gps_vel));
+		TIMED(STAGE_TICK, tick(DELTA_T_SECONDS));
+		record(STAGE_CYCLE, start);
+	}
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted samples */
+static uint64_t percentile(const struct samples *s, double p)
+{
+	unsigned rank = ceil(p / 100 * s->count);
+	return s->ns[rank ? rank - 1 : 0];
+}
+
+static void report(unsigned particles, bool json, bool *first)
+{
+	int stage;
+	for(stage = 0; stage < STAGES; ++stage)
+	{
+		struct samples *s = &samples[stage];
+		uint64_t total = 0;
+		unsigned i;
+		if(!s->count)
+			continue;
+		qsort(s->ns, s->count, sizeof(*s->ns), compare_u64);
+		for(i = 0; i < s->count; ++i)
+			total += s->ns[i];
+		double mean = (double) total / s->count;
+
+		if(json)
+			printf("%s\n  {\"particles\": %u, \"threads\": %u, \"simd_width\": %d, "
+			       "\"stage\": \"%s\", \"calls\": %u, \"ns_per_particle\": %.3f, "
+			       "\"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 ", "
+			       "\"calls_per_second\": %.1f}",
+			       *first ? "" : ",", particles, filter_options.threads, SIMD_WIDTH,
+			       stage_names[stage], s->count, mean / particles,
+			       percentile(s, 50), percentile(s, 99), s->ns[s->count - 1],
+			       1e9 / mean);
+		else
+			printf("%u,%u,%d,%s,%u,%.3f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.1f\n",
+			       particles, filter_options.threads, SIMD_WIDTH,
+			       stage_names[stage], s->count, mean / particles,
+			       percentile(s, 50), percentile(s, 99), s->ns[s->count - 1],
+			       1e9 / mean);
+		*first = false;
+		s->count = 0;
+	}
+}
+
+/* Parses a comma-separated list of particle counts */
+static unsigned *parse_counts(const char *list, unsigned *n)
+{
+	unsigned *counts, size = 1;
+	const char *p;
+	char *end;
+	for(p = list; *p; ++p)
+		if(*p == ',')
+			size++;
+	if(!(counts = malloc(size * sizeof(*counts))))
+	{
+		fprintf(stderr, "cannot allocate %u particle counts\n", size);
+		abort();
+	}
+	for(*n = 0, p = list; ; p = end + 1)
+	{
+		unsigned long count = strtoul(p, &end, 0);
+		if(end == p || (*end != ',' && *end) || count == 0 || count > UINT_MAX)
+		{
+			fprintf(stderr, "--counts takes a comma-separated list of positive particle counts, not '%s'\n", list);
+			exit(EXIT_FAILURE);
+		}
+		counts[(*n)++] = count;
+		if(!*end)
+			return counts;
+	}
+}
+
+int main(int argc, const char *const argv[])
+{
+	unsigned iterations = 1000, warmup = 100;
+	unsigned ncounts = sizeof(default_counts) / sizeof(*default_counts);
+	const unsigned *counts = default_counts;
+	bool json = false, first = true;
+	int i;
+
+	parse_trace_args(argc, argv);
+	for(i = 1; i < argc; i++)
+	{
+		if(!strncmp(argv[i], "--iterations=", 13))
+			iterations = strtoul(argv[i] + 13, NULL, 0);
+		else if(!strncmp(argv[i], "--warmup=", 9))
+			warmup = strtoul(argv[i] + 9, NULL, 0);
+		else if(!strncmp(argv[i], "--counts=", 9))
+			counts = parse_counts(argv[i] + 9, &ncounts);
+		else if(!strcmp(argv[i], "--json"))
+			json = true;
+	}
+	if(iterations < 1)
+		iterations = 1;
+
+	for(i = 0; i < STAGES; ++i)
+		if(!(samples[i].ns = malloc(iterations * sizeof(*samples[i].ns))))
+		{
+			fprintf(stderr, "cannot allocate %u samples\n", iterations);
+			abort();
+		}
+
+	/* The launch site lv2log replays, in radians */
+	initial_geodetic = (geodetic) {
+		.latitude = 43.79575081 * M_PI / 180,
+		.longitude = -120.65137954 * M_PI / 180,
+		.altitude = 1373.46,
+	};
+	init_atmosphere(LAYER0_BASE_TEMPERATURE, LAYER0_BASE_PRESSURE);
+	gravity_field_init(&pad_gravity, sim_gravity, filter_options.gravity_degree, initial_geodetic);
+	struct rocket_state pad = {
+		.pos = geodetic_to_ECEF(initial_geodetic),
+		.rotpos = mat3_to_quat(make_LTP_rotation(initial_geodetic)),
+	};
+
+	if(json)
+		printf("[");
+	else
+		printf("particles,threads,simd_width,stage,calls,ns_per_particle,p50_ns,p99_ns,max_ns,calls_per_second\n");
+	for(i = 0; i < (int) ncounts; ++i)
+	{
+		noise_stream_init(&sensor_noise, filter_options.seed, UINT64_MAX, 0);
+		filter_options.particles = counts[i];
+		set_filter_options(&filter_options);
+		init(initial_geodetic, quat_to_mat3(pad.rotpos));
+		run(&pad, iterations, warmup);
+		report(counts[i], json, &first);
+		fflush(stdout);
+	}
+	if(json)
+		printf("\n]\n");
+	return 0;
+}
@@ -0,0 +1,194 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "canlog.h"
+
+static bool in_map(const struct canlog *log, uint64_t offset, uint64_t length)
+{
+	return offset <= log->map_length && length <= log->map_length - offset;
+}
+
+static bool damaged(void)
+{
+	fprintf(stderr, "indexed log is truncated or damaged\n");
+	return false;
+}
+
+/* Finds the index of a mapped log that starts with the indexed format's
+ * header, returning false if it isn't whole. */
+static bool open_indexed(struct canlog *log)
+{
+	const struct canlog_header *header = (const void *) log->map;
+	const struct canlog_trailer *trailer;
+	uint32_t i;
+
+	if(header->byte_order != CANLOG_BYTE_ORDER)
+	{
+		fprintf(stderr, "indexed log was written on a machine of another byte order\n");
+		return false;
+	}
+	if(header->version != CANLOG_VERSION)
+	{
+		fprintf(stderr, "indexed log has unknown version %u\n", (unsigned) header->version);
+		return false;
+	}
+	if(log->map_length < sizeof(*header) + sizeof(*trailer) ||
+	   log->map_length % __alignof__(*trailer))
+		return damaged();
+	trailer = (const void *) (log->map + log->map_length - sizeof(*trailer));
+	if(memcmp(trailer->magic, CANLOG_MAGIC, sizeof(trailer->magic)) ||
+	   !in_map(log, trailer->directory_offset, (uint64_t) trailer->directory_entries * sizeof(*log->directory)) ||
+	   !in_map(log, trailer->chunk_offset, (uint64_t) trailer->chunks * sizeof(*log->chunk)) ||
+	   trailer->directory_offset % __alignof__(*log->directory) ||
+	   trailer->chunk_offset % __alignof__(*log->chunk))
+		return damaged();
+	log->directory = (const void *) (log->map + trailer->directory_offset);
+	log->chunk = (const void *) (log->map + trailer->chunk_offset);
+	log->chunks = trailer->chunks;
+	for(i = 0; i < log->chunks; ++i)
+		if(!in_map(log, log->chunk[i].offset, (uint64_t) log->chunk[i].count * (2 * sizeof(uint32_t) + 8)) ||
+		   log->chunk[i].count > CANLOG_CHUNK || log->chunk[i].offset % sizeof(uint32_t))
+			return damaged();
+	return true;
+}
+
+bool canlog_open(struct canlog *log, FILE *stream)
+{
+	struct stat st;
+	int fd = fileno(stream);
+
+	log->stream = stream;
+	log->map = NULL;
+	log->map_length = 0;
+	log->raw = NULL;
+	log->records = log->next = 0;
+	log->chunk = NULL;
+	log->directory = NULL;
+	log->chunks = log->next_chunk = 0;
+
+	/* Anything already buffered in the stream would be skipped by the
+	 * mapping, so only map a stream nobody has read from. */
+	if(fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+	   ftello(stream) != 0 || (uintmax_t) st.st_size > SIZE_MAX)
+	{
+		/* A logger's log never starts with the magic: its first word is
+		 * a CAN identifier, at most 11 bits shifted left by 5. */
+		int c = getc(stream);
+		if(c == CANLOG_MAGIC[0])
+		{
+			fprintf(stderr, "indexed logs must be read from a file, not a pipe\n");
+			return false;
+		}
+		if(c != EOF)
+			ungetc(c, stream);
+		return true;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map == MAP_FAILED)
+		return true;
+	log->map = map;
+	log->map_length = st.st_size;
+	if(log->map_length >= sizeof(struct canlog_header) &&
+	   !memcmp(log->map, CANLOG_MAGIC, sizeof(((struct canlog_header *) 0)->magic)))
+	{
+		if(open_indexed(log))
+			return true;
+		canlog_close(log);
+		return false;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	log->raw = map;
+	log->records = st.st_size / sizeof(struct canmsg_t);
+	return true;
+}
+
+/* A loop of independent byte swaps over fixed-stride records, which the
+ * compiler turns into vector byte shuffles on targets that have them
+ * (SSSE3 and later; see ARCH in the Makefile). */
+static void decode_headers(struct canlog *log, const struct canmsg_t *restrict raw, unsigned n)
+{
+	uint32_t *restrict id = log->id;
+	uint32_t *restrict timestamp = log->timestamp;
+	unsigned i;
+	for(i = 0; i < n; ++i)
+	{
+		id[i] = ntohl(raw[i].id);
+		timestamp[i] = ntohl(raw[i].timestamp);
+	}
+}
+
+bool canlog_read(struct canlog *log, struct canlog_batch *batch)
+{
+	const struct canmsg_t *raw;
+	if(log->chunk)
+	{
+		const struct canlog_chunk *chunk;
+		/* logindex never writes an empty chunk, but a damaged log
+		 * mustn't end the replay at one */
+		do {
+			if(log->next_chunk == log->chunks)
+				return false;
+			chunk = &log->chunk[log->next_chunk++];
+		} while(!chunk->count);
+		const uint8_t *base = log->map + chunk->offset;
+		batch->count = chunk->count;
+		batch->id = (const uint32_t *) base;
+		batch->timestamp = batch->id + chunk->count;
+		batch->data = (const uint8_t *) (batch->timestamp + chunk->count);
+		batch->stride = 8;
+		return true;
+	}
+	if(log->map)
+	{
+		size_t left = log->records - log->next;
+		batch->count = left < CANLOG_BATCH ? left : CANLOG_BATCH;
+		raw = log->raw + log->next;
+		log->next += batch->count;
+	}
+	else
+	{
+		batch->count = fread(log->buffer, sizeof(struct canmsg_t), CANLOG_BATCH, log->stream);
+		raw = log->buffer;
+	}
+	decode_headers(log, raw, batch->count);
+	batch->id = log->id;
+	batch->timestamp = log->timestamp;
+	batch->data = raw->data;
+	batch->stride = sizeof(struct canmsg_t);
+	return batch->count > 0;
+}
+
+bool canlog_seek(struct canlog *log, uint32_t timestamp)
+{
+	uint32_t low = 0, high = log->chunks;
+	if(!log->chunk)
+		return false;
+	/* last_timestamp never decreases from chunk to chunk */
+	while(low < high)
+	{
+		uint32_t mid = low + (high - low) / 2;
+		if(log->chunk[mid].last_timestamp < timestamp)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	log->next_chunk = low;
+	return true;
+}
+
+void canlog_close(struct canlog *log)
+{
+	if(log->map)
+		munmap((void *) log->map, log->map_length);
+	log->map = NULL;
+	log->raw = NULL;
+	log->chunk = NULL;
+}
@@ -0,0 +1,118 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#ifndef CANLOG_H
+#define CANLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "compiler.h"
+
+/* One record of a flight log as the logger wrote it, header fields in
+ * network byte order */
+struct canmsg_t {
+	uint32_t        id;             /* id<<5 + rtr<<4 + len */
+	uint32_t        timestamp;
+	unsigned char   data[8];
+};
+
+/* The indexed log format, which logindex writes from a logger's log:
+ *
+ *   struct canlog_header
+ *   each chunk: uint32_t id[count], timestamp[count]; uint8_t data[count][8]
+ *   struct canlog_directory_entry for every chunk, chunk after chunk
+ *   struct canlog_chunk for every chunk
+ *   struct canlog_trailer
+ *
+ * Ids and timestamps are decoded already, and everything is in the byte
+ * order of the machine that wrote it, so a reader maps the file and uses
+ * the columns in place.  The directory lists the CAN identifiers each
+ * chunk holds, with how many of each. */
+#define CANLOG_MAGIC "PSASCANX"
+#define CANLOG_BYTE_ORDER 0x01020304
+#define CANLOG_VERSION 1
+#define CANLOG_CHUNK 4096
+
+struct canlog_header {
+	char magic[8];
+	uint32_t byte_order;
+	uint32_t version;
+};
+
+struct canlog_chunk {
+	uint64_t offset;
+	uint32_t count;
+	/* its first nonzero timestamp, and the latest one in it or any
+	 * chunk before it, so the index stays sorted even where the logger's
+	 * clock stepped back; records the logger stamped 0 belong to no time */
+	uint32_t first_timestamp, last_timestamp;
+	/* its entries in the directory */
+	uint32_t directory, identifiers;
+};
+
+struct canlog_directory_entry {
+	uint16_t identifier;
+	uint16_t reserved;
+	uint32_t count;
+};
+
+struct canlog_trailer {
+	uint64_t directory_offset, chunk_offset;
+	uint32_t chunks, directory_entries;
+	char magic[8];
+};
+
+#define CANLOG_BATCH 1024
+
+/* A run of consecutive records, with the headers in host byte order and
+ * the payloads left where they are: in the mapped log, or in the stream
+ * buffer when the log can't be mapped.  Valid until the next
+ * canlog_read(). */
+struct canlog_batch {
+	unsigned count;
+	const uint32_t *id, *timestamp;
+	const uint8_t *data;
+	/* bytes from one record's payload to the next */
+	size_t stride;
+};
+
+static inline const uint8_t *canlog_data(const struct canlog_batch *batch, unsigned i)
+{
+	return batch->data + i * batch->stride;
+}
+
+/* Reads a logger's log from a regular file by mapping it whole, or from
+ * anything else (a pipe, say) a batch of records per read.  An indexed log
+ * is always mapped. */
+struct canlog {
+	FILE *stream;
+	const uint8_t *map;
+	size_t map_length;
+	/* for a logger's log, the records and the next to read */
+	const struct canmsg_t *raw;
+	size_t records, next;
+	/* for an indexed log, its chunks and the next to read */
+	const struct canlog_chunk *chunk;
+	const struct canlog_directory_entry *directory;
+	uint32_t chunks, next_chunk;
+	struct canmsg_t buffer[CANLOG_BATCH];
+	uint32_t id[CANLOG_BATCH], timestamp[CANLOG_BATCH];
+};
+
+/* Returns false, with a message on stderr, for a log it can't read */
+bool canlog_open(struct canlog *log, FILE *stream) ATTR_WARN_UNUSED_RESULT;
+/* Fills in the next batch, returning false at the end of the log.  A
+ * partial record at the end of a logger's log is ignored. */
+bool canlog_read(struct canlog *log, struct canlog_batch *batch);
+/* Skips ahead to the chunk that holds the first record stamped at or after
+ * timestamp, returning false if the log has no index to do that with;
+ * earlier records in that chunk are still read. */
+bool canlog_seek(struct canlog *log, uint32_t timestamp);
+void canlog_close(struct canlog *log);
+
+#endif /* CANLOG_H */
@@ -56,12 +56,12 @@ mat3 make_LTP_rotation(geodetic geodetic)
 
 vec3 ECEF_to_LTP(vec3 origin, mat3 rotation, vec3 ecef)
 {
-	return mat3_vec3_mul(rotation, vec_sub(ecef, origin));
+	return mat3_vec3_mul(&rotation, vec_sub(ecef, origin));
 }
 
 vec3 LTP_to_ECEF(vec3 origin, mat3 rotation, vec3 ltp)
 {
-	return vec_add(mat3_vec3_mul(mat3_transpose(rotation), ltp), origin);
+	return mat3_transpose_vec3_mul_add(&rotation, ltp, origin);
 }
 
 /* from http://www.colorado.edu/geography/gcraft/notes/datum/gif/xyzllh.gif
@@ -97,3 +97,172 @@ geodetic ECEF_to_geodetic(vec3 ecef)
 	geodetic.altitude = p * cos(geodetic.latitude) + (ecef.z + WGS84_ESQ * Nlat * sinlat) * sinlat - Nlat;
 	return geodetic;
 }
+
+/* The array conversions copy their input a chunk at a time into local
+ * arrays first.  That keeps them correct in place, and leaves the compiler
+ * few enough pointers that might alias to check for before it vectorizes. */
+#define COORD_CHUNK 64
+
+struct chunk {
+	double x[COORD_CHUNK], y[COORD_CHUNK], z[COORD_CHUNK];
+};
+
+/* Indices are offset by pointer rather than by adding begin to each: the
+ * compiler can't rule out that an unsigned sum wraps, and then treats the
+ * accesses as scattered. */
+static unsigned load_chunk(struct chunk *c, const double *x, const double *y, const double *z,
+                           unsigned begin, unsigned end)
+{
+	unsigned i, n = end - begin < COORD_CHUNK ? end - begin : COORD_CHUNK;
+	x += begin;
+	y += begin;
+	z += begin;
+	for(i = 0; i < n; ++i)
+	{
+		c->x[i] = x[i];
+		c->y[i] = y[i];
+		c->z[i] = z[i];
+	}
+	return n;
+}
+
+/* The sines and cosines are taken in separate loops: when a loop needs both
+ * of the same angle the compiler fuses them into sincos(), which it cannot
+ * vectorize. */
+void geodetic_to_ECEF_array(struct vec3_array *ecef, const struct geodetic_array *geodetic,
+                            unsigned begin, unsigned end)
+{
+	double r[COORD_CHUNK];
+	struct chunk c;
+	unsigned i, n;
+	for(; begin < end; begin += n)
+	{
+		double *x = ecef->x + begin, *y = ecef->y + begin, *z = ecef->z + begin;
+		n = load_chunk(&c, geodetic->latitude, geodetic->longitude, geodetic->altitude, begin, end);
+		for(i = 0; i < n; ++i)
+		{
+			double sinlat = sin(c.x[i]);
+			double Nlat = WGS84_A / sqrt(1 - WGS84_ESQ * sinlat * sinlat);
+			z[i] = (c.z[i] + (1 - WGS84_ESQ) * Nlat) * sinlat;
+			r[i] = c.z[i] + Nlat;
+		}
+		for(i = 0; i < n; ++i)
+			r[i] *= cos(c.x[i]);
+		for(i = 0; i < n; ++i)
+			x[i] = r[i] * cos(c.y[i]);
+		for(i = 0; i < n; ++i)
+			y[i] = r[i] * sin(c.y[i]);
+	}
+}
+
+/* With theta the parametric latitude, Bowring's latitude is the angle of
+ * (p - e^2 a cos^3 theta, z + e'^2 b sin^3 theta), and theta itself the
+ * angle of (p b, z a): every sine and cosine is a ratio of square roots.
+ * The altitude p cos lat + z sin lat - a sqrt(1 - e^2 sin^2 lat) is the
+ * expression ECEF_to_geodetic() uses with N multiplied through. */
+static void ECEF_to_geodetic_fast(struct geodetic_array *geodetic, const struct vec3_array *ecef,
+                                  unsigned begin, unsigned end)
+{
+	const double EDOTSQ = (WGS84_A * WGS84_A - WGS84_B * WGS84_B) /
+		(WGS84_B * WGS84_B);
+	struct chunk c;
+	unsigned i, n;
+	for(; begin < end; begin += n)
+	{
+		double *latitude = geodetic->latitude + begin, *longitude = geodetic->longitude + begin;
+		double *altitude = geodetic->altitude + begin;
+		n = load_chunk(&c, ecef->x, ecef->y, ecef->z, begin, end);
+		for(i = 0; i < n; ++i)
+		{
+			double x = c.x[i], y = c.y[i], z = c.z[i];
+			double p = sqrt(x * x + y * y);
+			double za = z * WGS84_A, pb = p * WGS84_B;
+			double r = 1 / sqrt(za * za + pb * pb);
+			double st = za * r, ct = pb * r;
+			double num = z + EDOTSQ * WGS84_B * st * st * st;
+			double den = p - WGS84_ESQ * WGS84_A * ct * ct * ct;
+			double q = 1 / sqrt(num * num + den * den);
+			double sinlat = num * q, coslat = den * q;
+			latitude[i] = atan2(num, den);
+			longitude[i] = atan2(y, x);
+			altitude[i] = p * coslat + z * sinlat -
+				WGS84_A * sqrt(1 - WGS84_ESQ * sinlat * sinlat);
+		}
+	}
+}
+
+void ECEF_to_geodetic_array(struct geodetic_array *geodetic, const struct vec3_array *ecef,
+                            unsigned begin, unsigned end, enum geodetic_method method)
+{
+	unsigned i;
+	if(method == GEODETIC_FAST)
+	{
+		ECEF_to_geodetic_fast(geodetic, ecef, begin, end);
+		return;
+	}
+	for(i = begin; i < end; ++i)
+	{
+		struct geodetic point = ECEF_to_geodetic(vec3_array_get(ecef, i));
+		geodetic->latitude[i] = point.latitude;
+		geodetic->longitude[i] = point.longitude;
+		geodetic->altitude[i] = point.altitude;
+	}
+}
+
+/* Both directions are one rotation plus one offset per point */
+static void transform(struct vec3_array *out, mat3 rotation, vec3 before, vec3 after,
+                      const struct vec3_array *in, unsigned begin, unsigned end)
+{
+	double m00 = rotation.component[0][0], m01 = rotation.component[0][1], m02 = rotation.component[0][2];
+	double m10 = rotation.component[1][0], m11 = rotation.component[1][1], m12 = rotation.component[1][2];
+	double m20 = rotation.component[2][0], m21 = rotation.component[2][1], m22 = rotation.component[2][2];
+	struct chunk c;
+	unsigned i, n;
+	for(; begin < end; begin += n)
+	{
+		double *ox = out->x + begin, *oy = out->y + begin, *oz = out->z + begin;
+		n = load_chunk(&c, in->x, in->y, in->z, begin, end);
+		for(i = 0; i < n; ++i)
+		{
+			double x = c.x[i] - before.x, y = c.y[i] - before.y, z = c.z[i] - before.z;
+			ox[i] = m00 * x + m01 * y + m02 * z + after.x;
+			oy[i] = m10 * x + m11 * y + m12 * z + after.y;
+			oz[i] = m20 * x + m21 * y + m22 * z + after.z;
+		}
+	}
+}
+
+void ECEF_to_LTP_array(struct vec3_array *ltp, vec3 origin, mat3 rotation,
+                       const struct vec3_array *ecef, unsigned begin, unsigned end)
+{
+	transform(ltp, rotation, origin, (vec3) { 0, 0, 0 }, ecef, begin, end);
+}
+
+void LTP_to_ECEF_array(struct vec3_array *ecef, vec3 origin, mat3 rotation,
+                       const struct vec3_array *ltp, unsigned begin, unsigned end)
+{
+	transform(ecef, mat3_transpose(&rotation), (vec3) { 0, 0, 0 }, origin, ltp, begin, end);
+}
+
+struct LTP_altitude make_LTP_altitude(geodetic origin)
+{
+	double sinlat = sin(origin.latitude);
+	double Nlat = N(origin.latitude);
+	return (struct LTP_altitude) {
+		.origin = geodetic_to_ECEF(origin),
+		.rotation = make_LTP_rotation(origin),
+		.altitude = origin.altitude,
+		.east_radius = Nlat + origin.altitude,
+		.north_radius = Nlat * (1 - WGS84_ESQ) / (1 - WGS84_ESQ * sinlat * sinlat) + origin.altitude,
+	};
+}
+
+/* The ellipsoid drops away from the tangent plane by e^2 / 2R to the east
+ * and n^2 / 2R to the north, with R measured at the point's own height. */
+double LTP_altitude(const struct LTP_altitude *ltp, vec3 ecef)
+{
+	vec3 d = ECEF_to_LTP(ltp->origin, ltp->rotation, ecef);
+	return ltp->altitude + d.z +
+	       d.x * d.x / (2 * (ltp->east_radius + d.z)) +
+	       d.y * d.y / (2 * (ltp->north_radius + d.z));
+}
@@ -40,6 +40,19 @@ static bool mat3_similar(const mat3 expected, const mat3 actual)
 	return true;
 }
 
+static bool vec3_array_similar(const char *name, const struct vec3_array *expected,
+                               const struct vec3_array *actual, unsigned n)
+{
+	unsigned i;
+	for(i = 0; i < n; ++i)
+		if(!vec3_similar(vec3_array_get(expected, i), vec3_array_get(actual, i)))
+		{
+			printf("%s differs from the scalar conversion at point %u\n", name, i);
+			return false;
+		}
+	return true;
+}
+
 static void mat3_show(const mat3 mat)
 {
 	int i;
@@ -70,6 +83,13 @@ int main(void)
 	geodetic g;
 	mat3 rot;
 	int i;
+	enum { POINTS = 13 * 9 * 4 };
+	static double lat[POINTS], lon[POINTS], alt[POINTS];
+	static double x[POINTS], y[POINTS], z[POINTS];
+	static double ex[POINTS], ey[POINTS], ez[POINTS];
+	struct geodetic_array points = { lat, lon, alt };
+	struct vec3_array ecef = { x, y, z }, expected = { ex, ey, ez };
+	unsigned n, method;
 
 	g = ECEF_to_geodetic(ecef_ref);
 	if(!geodetic_similar(geodetic_ref, g))
@@ -117,5 +137,73 @@ int main(void)
 		}
 	}
 
+	/* The array conversions against the scalar ones, from pole to pole */
+	for(n = 0; n < POINTS; ++n)
+	{
+		lat[n] = (n % 13 * 15.0 - 90) * M_PI / 180;
+		lon[n] = (n / 13 % 9 * 45.0 - 180) * M_PI / 180;
+		alt[n] = (const double[]) { -500, 0, 1e4, 1e5 }[n / (13 * 9)];
+		vec3_array_set(&expected, n, geodetic_to_ECEF(geodetic_array_get(&points, n)));
+	}
+	geodetic_to_ECEF_array(&ecef, &points, 0, POINTS);
+	if(!vec3_array_similar("geodetic_to_ECEF_array", &expected, &ecef, POINTS))
+		++fail;
+
+	for(method = GEODETIC_BOWRING; method <= GEODETIC_FAST; ++method)
+	{
+		ECEF_to_geodetic_array(&points, &ecef, 0, POINTS, method);
+		for(n = 0; n < POINTS; ++n)
+		{
+			geodetic expected_g = ECEF_to_geodetic(vec3_array_get(&ecef, n));
+			g = geodetic_array_get(&points, n);
+			if(!geodetic_similar(expected_g, g))
+			{
+				printf("ECEF_to_geodetic_array method %u returned <lat %f, long %f, alt %f>, expected <lat %f, long %f, alt %f>\n",
+				       method, g.latitude, g.longitude, g.altitude,
+				       expected_g.latitude, expected_g.longitude, expected_g.altitude);
+				++fail;
+				break;
+			}
+		}
+	}
+
+	v = geodetic_to_ECEF(geodetic_ref);
+	for(n = 0; n < POINTS; ++n)
+		vec3_array_set(&expected, n, ECEF_to_LTP(v, rot, vec3_array_get(&ecef, n)));
+	ECEF_to_LTP_array(&ecef, v, rot, &ecef, 0, POINTS);
+	if(!vec3_array_similar("ECEF_to_LTP_array", &expected, &ecef, POINTS))
+		++fail;
+	for(n = 0; n < POINTS; ++n)
+		vec3_array_set(&expected, n, LTP_to_ECEF(v, rot, vec3_array_get(&ecef, n)));
+	LTP_to_ECEF_array(&ecef, v, rot, &ecef, 0, POINTS);
+	if(!vec3_array_similar("LTP_to_ECEF_array", &expected, &ecef, POINTS))
+		++fail;
+
+	/* The tangent-plane altitude against the full conversion, out to 20 km
+	 * from a launch site and 30 km above it */
+	const geodetic pad = {
+		.latitude = 43.79575081 * M_PI / 180,
+		.longitude = -120.65137954 * M_PI / 180,
+		.altitude = 1373.46,
+	};
+	struct LTP_altitude ltp = make_LTP_altitude(pad);
+	double east, north, up, worst = 0;
+	for(east = -20000; east <= 20000; east += 2500)
+		for(north = -20000; north <= 20000; north += 2500)
+			for(up = -500; up <= 30000; up += 2500)
+			{
+				if(east * east + north * north > 20000.0 * 20000.0)
+					continue;
+				v = LTP_to_ECEF(ltp.origin, ltp.rotation, (vec3) { east, north, up });
+				double error = fabs(LTP_altitude(&ltp, v) - ECEF_to_geodetic(v).altitude);
+				if(error > worst)
+					worst = error;
+			}
+	if(worst > 0.001)
+	{
+		printf("LTP_altitude is up to %f m from ECEF_to_geodetic, expected under a millimeter\n", worst);
+		++fail;
+	}
+
 	exit(fail);
 }
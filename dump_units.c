@@ -63,8 +63,30 @@ void pressure_sensor(unsigned pressure)
 	printf("pressure\t%f\t%f\n", time, altitude);
 }
 
+void set_filter_options(const struct filter_options *options)
+{
+	(void) options;
+}
+
 void init(geodetic initial_geodetic_in, mat3 initial_rotation_in)
 {
 	(void) initial_geodetic_in;
 	(void) initial_rotation_in;
 }
+
+size_t checkpoint_size(void)
+{
+	return 0;
+}
+
+void save_checkpoint(void *blob)
+{
+	(void) blob;
+}
+
+bool restore_checkpoint(const void *blob, size_t size)
+{
+	(void) blob;
+	(void) size;
+	return false;
+}
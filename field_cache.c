@@ -0,0 +1,139 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "field_cache.h"
+
+/* Meters per radian of latitude at least, and of longitude on the equator:
+ * the WGS84 meridional radius at the equator, and the semi-major axis.
+ * Using the least for latitude makes sure the grid covers the radius. */
+static const double MIN_NORTH_RADIUS = 6335439.3;
+static const double EQUATOR_RADIUS = 6378137.0;
+
+static vec3 *cell(const struct field_cache *cache, unsigned i, unsigned j, unsigned k)
+{
+	return &cache->value[(i * cache->size[1] + j) * cache->size[2] + k];
+}
+
+static unsigned points(double span, double spacing)
+{
+	return (unsigned) ceil(span / spacing) + 1;
+}
+
+static double lerp(double a, double b, double t)
+{
+	return a + (b - a) * t;
+}
+
+static vec3 vec_lerp(vec3 a, vec3 b, double t)
+{
+	return (vec3) { lerp(a.x, b.x, t), lerp(a.y, b.y, t), lerp(a.z, b.z, t) };
+}
+
+bool field_cache_fits(geodetic center, double radius)
+{
+	center = ECEF_to_geodetic(geodetic_to_ECEF(center));
+	double half_lat = radius / MIN_NORTH_RADIUS;
+	double half_lon = radius / (EQUATOR_RADIUS * cos(center.latitude));
+	return fabs(center.latitude) + half_lat < M_PI_2 && half_lon < M_PI;
+}
+
+/* The grid doesn't wrap across the antimeridian or over a pole; positions
+ * beyond either edge are simply off the grid.  The center goes through ECEF
+ * first so that it lands in the same ranges that ECEF_to_geodetic() gives
+ * the positions looked up later. */
+bool field_cache_init(struct field_cache *cache, vec3 (*field)(geodetic position),
+                      geodetic center, double radius, double below, double above,
+                      double spacing)
+{
+	center = ECEF_to_geodetic(geodetic_to_ECEF(center));
+	double east_radius = EQUATOR_RADIUS * cos(center.latitude);
+	double half_lat = radius / MIN_NORTH_RADIUS;
+	double half_lon = radius / east_radius;
+	unsigned i, j, k;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->field = field;
+	cache->size[0] = points(2 * radius, spacing);
+	cache->size[1] = points(2 * radius, spacing);
+	cache->size[2] = points(below + above, spacing);
+	cache->origin = (geodetic) {
+		.latitude = center.latitude - half_lat,
+		.longitude = center.longitude - half_lon,
+		.altitude = center.altitude - below,
+	};
+	cache->step = (geodetic) {
+		.latitude = 2 * half_lat / (cache->size[0] - 1),
+		.longitude = 2 * half_lon / (cache->size[1] - 1),
+		.altitude = (below + above) / (cache->size[2] - 1),
+	};
+	cache->value = malloc(cache->size[0] * cache->size[1] * cache->size[2] * sizeof(*cache->value));
+	if(!cache->value)
+		return false;
+
+	for(i = 0; i < cache->size[0]; ++i)
+		for(j = 0; j < cache->size[1]; ++j)
+			for(k = 0; k < cache->size[2]; ++k)
+				*cell(cache, i, j, k) = field((geodetic) {
+					.latitude = cache->origin.latitude + i * cache->step.latitude,
+					.longitude = cache->origin.longitude + j * cache->step.longitude,
+					.altitude = cache->origin.altitude + k * cache->step.altitude,
+				});
+
+	for(i = 0; i + 1 < cache->size[0]; ++i)
+		for(j = 0; j + 1 < cache->size[1]; ++j)
+			for(k = 0; k + 1 < cache->size[2]; ++k)
+			{
+				geodetic mid = {
+					.latitude = cache->origin.latitude + (i + 0.5) * cache->step.latitude,
+					.longitude = cache->origin.longitude + (j + 0.5) * cache->step.longitude,
+					.altitude = cache->origin.altitude + (k + 0.5) * cache->step.altitude,
+				};
+				double error = vec_abs(vec_sub(field_cache_lookup(cache, mid), field(mid)));
+				if(error > cache->max_error)
+					cache->max_error = error;
+			}
+	return true;
+}
+
+void field_cache_free(struct field_cache *cache)
+{
+	free(cache->value);
+	cache->value = NULL;
+}
+
+vec3 field_cache_lookup(const struct field_cache *cache, geodetic position)
+{
+	if(!cache->value)
+		return cache->field(position);
+
+	double f[3] = {
+		(position.latitude - cache->origin.latitude) / cache->step.latitude,
+		(position.longitude - cache->origin.longitude) / cache->step.longitude,
+		(position.altitude - cache->origin.altitude) / cache->step.altitude,
+	};
+	unsigned index[3];
+	double t[3];
+	int axis;
+
+	for(axis = 0; axis < 3; ++axis)
+	{
+		double last = cache->size[axis] - 1;
+		if(!(f[axis] >= 0 && f[axis] <= last))
+			return cache->field(position);
+		index[axis] = f[axis] < last ? (unsigned) f[axis] : cache->size[axis] - 2;
+		t[axis] = f[axis] - index[axis];
+	}
+
+	unsigned i = index[0], j = index[1], k = index[2];
+	vec3 c00 = vec_lerp(*cell(cache, i, j, k), *cell(cache, i + 1, j, k), t[0]);
+	vec3 c01 = vec_lerp(*cell(cache, i, j, k + 1), *cell(cache, i + 1, j, k + 1), t[0]);
+	vec3 c10 = vec_lerp(*cell(cache, i, j + 1, k), *cell(cache, i + 1, j + 1, k), t[0]);
+	vec3 c11 = vec_lerp(*cell(cache, i, j + 1, k + 1), *cell(cache, i + 1, j + 1, k + 1), t[0]);
+	return vec_lerp(vec_lerp(c00, c10, t[1]), vec_lerp(c01, c11, t[1]), t[2]);
+}
@@ -0,0 +1,44 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#ifndef FIELD_CACHE_H
+#define FIELD_CACHE_H
+
+#include <stdbool.h>
+#include "compiler.h"
+#include "coord.h"
+#include "vec.h"
+
+/* A smooth field, such as magnetic_field(), sampled on a regular grid in
+ * latitude, longitude and altitude around a point and interpolated
+ * trilinearly in between.  Positions off the grid get the field itself. */
+struct field_cache {
+	vec3 (*field)(geodetic position);
+	/* the grid point with the lowest coordinates, and the grid spacing */
+	geodetic origin, step;
+	/* grid points along latitude, longitude and altitude */
+	unsigned size[3];
+	/* NULL once freed, leaving lookups to the field itself */
+	vec3 *value;
+	/* The largest difference from the field found at the cell centers,
+	 * where interpolation is at its worst */
+	double max_error;
+};
+
+/* Whether a grid radius meters around center stays clear of the poles,
+ * where field_cache_init() could only build one that is no use */
+bool field_cache_fits(geodetic center, double radius) ATTR_WARN_UNUSED_RESULT;
+/* Covers everything within radius meters of center horizontally, from
+ * below meters under it to above meters over it, with points about spacing
+ * meters apart. */
+bool field_cache_init(struct field_cache *cache, vec3 (*field)(geodetic position),
+                      geodetic center, double radius, double below, double above,
+                      double spacing) ATTR_WARN_UNUSED_RESULT;
+/* Drops the grid; lookups then pass straight through to the field */
+void field_cache_free(struct field_cache *cache);
+vec3 field_cache_lookup(const struct field_cache *cache, geodetic position) ATTR_WARN_UNUSED_RESULT;
+
+#endif /* FIELD_CACHE_H */
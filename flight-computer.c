@@ -6,16 +6,25 @@
  */
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "coord.h"
+#include "field_cache.h"
 #include "gprob.h"
+#include "gravity.h"
+#include "integrate.h"
 #include "interface.h"
+#include "likelihood.h"
+#include "noise.h"
 #include "particle.h"
 #include "physics.h"
 #include "pressure_sensor.h"
+#include "profile.h"
 #include "resample.h"
 #include "sensors.h"
-#include "ziggurat/zrandom.h"
+#include "spherical_harmonics.h"
+#include "workers.h"
 
 /* Unless explicitly stated otherwise, all values use SI units: meters,
  * meters/second, meters/second^2, radians.
@@ -32,23 +41,109 @@ static const vec3 acc_sd_rel = { 0.01, 0.01, 1 };
 static const vec3 vel_sd = { 0.2, 0.2, 0.2 };
 static const vec3 pos_sd = { 0.2, 0.2, 0.2 };
 
-#define PARTICLE_COUNT 1000
-static struct particle particle_arrays[2][PARTICLE_COUNT];
-static struct particle *particles = particle_arrays[0];
+/* Every random draw the filter makes comes from its own noise stream,
+ * numbered in the order they're made; a draw spread over the worker pool
+ * takes a substream per block. */
+static uint64_t noise_draws;
+
+/* Ticks since the attitude quaternions were last renormalized */
+static unsigned ticks_since_renormalize;
+
+/* KLD-sampling bounds: the particle set's position/velocity histogram uses
+ * bins of this size, and it targets an error of KLD_EPSILON with 99%
+ * confidence. */
+static const double kld_pos_bin = 1.0;
+static const double kld_vel_bin = 1.0;
+#define KLD_EPSILON 0.05
+#define KLD_Z 2.326
+
+/* Resample once the effective particles fall below this fraction */
+#define RESAMPLE_THRESHOLD 0.05
+
+static struct particle_store particle_stores[2];
+static struct particle_store *particles = &particle_stores[0];
 static unsigned int which_particles = 0;
 
-#define for_each_particle(particle) \
-	for(particle = particles; \
-	    particle != particles + PARTICLE_COUNT; \
-	    particle++)
+#define for_each_particle(i) \
+	for(i = 0; i < particles->count; i++)
+
+/* Per-particle inputs to the likelihood kernels */
+static struct vec3_array noise, predicted;
+
+/* Each particle's geodetic position, recomputed a block at a time on first
+ * use after anything in the block moves.  Particles within
+ * options.ltp_radius of the launch site take their altitude from the
+ * tangent plane there instead. */
+static struct geodetic_array geodetic_cache;
+static bool *geodetic_fresh;
+static struct LTP_altitude launch_ltp;
+
+/* The magnetic field on a grid around the launch site, from a kilometer
+ * under it to 50 km over it and 50 km around.  init() refines the grid until
+ * interpolation stays within the tolerance (nT) of the full model, which is
+ * a tenth of the magnetometer's noise, or gives up and uses the full model.
+ * Near a pole the field turns with longitude faster than any grid follows,
+ * so there init() goes straight to the full model. */
+static struct field_cache magnetic_cache;
+static const double magnetic_cache_radius = 50000;
+static const double magnetic_cache_below = 1000;
+static const double magnetic_cache_above = 50000;
+static const double magnetic_cache_tolerance = 0.1;
+
+/* Gravity as options.gravity models it, expanded about the launch site */
+static struct gravity_field gravity;
+
+/* Linear weights handed to the resampler, and the ancestor it picks for
+ * each particle of the next set */
+static double *linear_weight;
+static unsigned *ancestor;
+static struct genealogy genealogy;
+
+/* Weighted first and second moments of one vector, taken about a reference
+ * point to keep the sums well conditioned */
+struct moments {
+	vec3 sum;
+	double xx, xy, xz, yy, yz, zz;
+};
+
+/* Per-block partial results of the reductions over the particle set */
+static struct partial {
+	double max_weight, total_weight, squared_weights;
+	double on_ground, deploy_drogue, deploy_main;
+	struct moments pos, vel, acc, rotvel;
+} *partials;
+
+/* Statistics of the weighted particle set, from weigh_particles().  Each
+ * particle's weight is its log linear_weight, so its normalized weight is
+ * linear_weight / total_weight. */
+static struct estimate {
+	double total_weight, effective_particles;
+	struct rocket_state mean;
+	mat3 pos_cov, vel_cov, acc_cov, rotvel_cov;
+} estimate;
+
+static struct filter_options options = FILTER_OPTIONS_DEFAULT;
 
 static enum state state = STATE_PREFLIGHT;
 
 static bool can_arm;
 
+/* How long each condition update_state() watches for has held, and how
+ * long until it may fire each chute again */
+static struct timers {
+	double on_ground_for, not_on_ground_for;
+	double deploy_drogue_for, drogue_wait;
+	double deploy_main_for, main_wait;
+} timers;
+
 static geodetic initial_geodetic;
 static vec3 initial_ecef;
-static mat3 initial_rotation;
+static quat initial_rotation;
+
+void set_filter_options(const struct filter_options *options_in)
+{
+	options = *options_in;
+}
 
 static void change_state(enum state new_state)
 {
@@ -56,18 +151,112 @@ static void change_state(enum state new_state)
 	report_state(state);
 }
 
+static void init_magnetic_cache(void)
+{
+	double spacing = 5000;
+	if(!field_cache_fits(initial_geodetic, magnetic_cache_radius))
+	{
+		field_cache_free(&magnetic_cache);
+		magnetic_cache.field = magnetic_field;
+		return;
+	}
+	do {
+		field_cache_free(&magnetic_cache);
+		if(!field_cache_init(&magnetic_cache, magnetic_field, initial_geodetic,
+		                     magnetic_cache_radius, magnetic_cache_below,
+		                     magnetic_cache_above, spacing))
+		{
+			fprintf(stderr, "cannot allocate the magnetic field grid\n");
+			abort();
+		}
+		spacing /= 2;
+	} while(magnetic_cache.max_error > magnetic_cache_tolerance && spacing >= 2000);
+	if(magnetic_cache.max_error > magnetic_cache_tolerance)
+		field_cache_free(&magnetic_cache);
+}
+
 void init(geodetic initial_geodetic_in, mat3 initial_rotation_in)
 {
-	struct particle *particle;
+	unsigned i;
 	initial_geodetic = initial_geodetic_in;
 	initial_ecef = geodetic_to_ECEF(initial_geodetic);
-	initial_rotation = initial_rotation_in;
-	for_each_particle(particle)
+	initial_rotation = mat3_to_quat(initial_rotation_in);
+	launch_ltp = make_LTP_altitude(initial_geodetic);
+	init_magnetic_cache();
+	gravity_field_init(&gravity, options.gravity, options.gravity_degree, initial_geodetic);
+
+	if(options.particles < 1)
+		options.particles = 1;
+	if(options.adaptive)
 	{
-		particle->weight = -log(PARTICLE_COUNT);
-		particle->s.pos = initial_ecef;
-		particle->s.rotpos = initial_rotation;
+		if(options.min_particles < 1)
+			options.min_particles = 1;
+		if(options.max_particles < options.min_particles)
+			options.max_particles = options.min_particles;
+		if(options.particles < options.min_particles)
+			options.particles = options.min_particles;
+		if(options.particles > options.max_particles)
+			options.particles = options.max_particles;
 	}
+	unsigned capacity = options.adaptive ? options.max_particles : options.particles;
+	if(particle_stores[0].capacity != capacity)
+	{
+		for(i = 0; i < 2; ++i)
+			particle_store_free(&particle_stores[i]);
+		vec3_array_free(&noise);
+		vec3_array_free(&predicted);
+		free(partials);
+		free(linear_weight);
+		free(ancestor);
+		free(geodetic_cache.latitude);
+		free(geodetic_fresh);
+		if(!particle_store_init(&particle_stores[0], capacity) ||
+		   !particle_store_init(&particle_stores[1], capacity) ||
+		   !vec3_array_init(&noise, capacity) ||
+		   !vec3_array_init(&predicted, capacity) ||
+		   !(linear_weight = malloc(capacity * sizeof(*linear_weight))) ||
+		   !(ancestor = malloc(capacity * sizeof(*ancestor))) ||
+		   !(geodetic_cache.latitude = malloc(3 * capacity * sizeof(double))) ||
+		   !(geodetic_fresh = malloc(work_blocks(capacity) * sizeof(*geodetic_fresh))) ||
+		   !(partials = calloc(work_blocks(capacity), sizeof(*partials))))
+		{
+			fprintf(stderr, "cannot allocate %u particles\n", capacity);
+			abort();
+		}
+		geodetic_cache.longitude = geodetic_cache.latitude + capacity;
+		geodetic_cache.altitude = geodetic_cache.latitude + 2 * capacity;
+	}
+	if(genealogy.depth != options.genealogy || genealogy.capacity != capacity)
+	{
+		genealogy_free(&genealogy);
+		if(options.genealogy && !genealogy_init(&genealogy, options.genealogy, capacity))
+		{
+			fprintf(stderr, "cannot allocate %u generations of ancestry\n", options.genealogy);
+			abort();
+		}
+	}
+	genealogy_clear(&genealogy);
+	noise_draws = 0;
+	ticks_since_renormalize = 0;
+	memset(geodetic_fresh, 0, work_blocks(capacity) * sizeof(*geodetic_fresh));
+	which_particles = 0;
+	particles = &particle_stores[0];
+	particles->count = options.particles;
+
+	workers_stop();
+	if(options.threads > 1 && !workers_start(options.threads - 1))
+		enqueue_error("Cannot start worker threads; filtering on one core.");
+
+	const struct rocket_state initial_state = {
+		.pos = initial_ecef,
+		.rotpos = initial_rotation,
+	};
+	for_each_particle(i)
+	{
+		particles->weight[i] = -log(particles->count);
+		particle_set_state(particles, i, &initial_state);
+	}
+	estimate = (struct estimate) { .mean = initial_state };
 }
 
 static void hysteresis(double *duration, double delta_t, bool set)
@@ -89,83 +278,221 @@ static bool ratelimit(double *delay, double delta_t, bool enable)
 	return true;
 }
 
-/* Returns the estimated number of effective particles */
-static double normalize_particles(void)
+static void find_max_weight(void *unused, unsigned begin, unsigned end, unsigned block)
 {
-	struct particle *particle;
+	const double *weight = particles->weight;
+	double max_weight = weight[begin];
+	unsigned i;
+	(void) unused;
+	for(i = begin; i < end; ++i)
+		if (weight[i] > max_weight)
+			max_weight = weight[i];
+	partials[block].max_weight = max_weight;
+}
 
-	/* take everything down to below the maximum weight
-	   so that exp() will underflow rather than overflow */
-	double max_weight = particles[0].weight;
-	for_each_particle(particle)
-		if (particle->weight > max_weight)
-			max_weight = particle->weight;
+static inline void accumulate(struct moments *m, const struct vec3_array *a, unsigned i,
+                              vec3 reference, double weight)
+{
+	double x = a->x[i] - reference.x;
+	double y = a->y[i] - reference.y;
+	double z = a->z[i] - reference.z;
+	double wx = weight * x, wy = weight * y, wz = weight * z;
+	m->sum.x += wx;
+	m->sum.y += wy;
+	m->sum.z += wz;
+	m->xx += wx * x;
+	m->xy += wx * y;
+	m->xz += wx * z;
+	m->yy += wy * y;
+	m->yz += wy * z;
+	m->zz += wz * z;
+}
+
+static void add_moments(struct moments *m, const struct moments *n)
+{
+	m->sum = vec_add(m->sum, n->sum);
+	m->xx += n->xx;
+	m->xy += n->xy;
+	m->xz += n->xz;
+	m->yy += n->yy;
+	m->yz += n->yz;
+	m->zz += n->zz;
+}
 
-	/* compute the total adjusted weight */
-	double total_weight = 0.0;
-	for_each_particle(particle)
+/* Turns moments about reference into a mean and a covariance */
+static vec3 finish_moments(const struct moments *m, vec3 reference, double total, mat3 *cov)
+{
+	vec3 d = vec_scale(m->sum, 1.0 / total);
+	cov->component[0][0] = m->xx / total - d.x * d.x;
+	cov->component[0][1] = cov->component[1][0] = m->xy / total - d.x * d.y;
+	cov->component[0][2] = cov->component[2][0] = m->xz / total - d.x * d.z;
+	cov->component[1][1] = m->yy / total - d.y * d.y;
+	cov->component[1][2] = cov->component[2][1] = m->yz / total - d.y * d.z;
+	cov->component[2][2] = m->zz / total - d.z * d.z;
+	return vec_add(reference, d);
+}
+
+/* Shifts the log weights down by the maximum, so that exp() will underflow
+ * rather than overflow, and takes every statistic of the set from the one
+ * exp() per particle. */
+static void shift_weights(void *max_weight, unsigned begin, unsigned end, unsigned block)
+{
+	double *weight = particles->weight;
+	double shift = *(double *) max_weight;
+	const struct rocket_state *reference = &estimate.mean;
+	struct partial *partial = &partials[block];
+	double total_weight = 0.0, squared_weights = 0.0;
+	unsigned i;
+
+	memset(&partial->pos, 0, sizeof(partial->pos));
+	memset(&partial->vel, 0, sizeof(partial->vel));
+	memset(&partial->acc, 0, sizeof(partial->acc));
+	memset(&partial->rotvel, 0, sizeof(partial->rotvel));
+	for(i = begin; i < end; ++i)
 	{
-		particle->weight -= max_weight;
-		total_weight += exp(particle->weight);
+		double w = exp(weight[i] -= shift);
+		linear_weight[i] = w;
+		total_weight += w;
+		squared_weights += w * w;
+		accumulate(&partial->pos, &particles->pos, i, reference->pos, w);
+		accumulate(&partial->vel, &particles->vel, i, reference->vel, w);
+		accumulate(&partial->acc, &particles->acc, i, reference->acc, w);
+		accumulate(&partial->rotvel, &particles->rotvel, i, reference->rotvel, w);
 	}
-	total_weight = log(total_weight);
+	partial->total_weight = total_weight;
+	partial->squared_weights = squared_weights;
+}
+
+/* Two passes: the maximum log weight, then everything else */
+static void weigh_particles(void)
+{
+	unsigned block, blocks = work_blocks(particles->count);
 
-	/* adjust the particles */
-	double squared_weights = 0.0;
-	for_each_particle(particle)
+	workers_run(find_max_weight, NULL, particles->count);
+	double max_weight = partials[0].max_weight;
+	for(block = 1; block < blocks; ++block)
+		if (partials[block].max_weight > max_weight)
+			max_weight = partials[block].max_weight;
+
+	workers_run(shift_weights, &max_weight, particles->count);
+	struct partial sum = partials[0];
+	for(block = 1; block < blocks; ++block)
 	{
-		particle->weight -= total_weight;
-		squared_weights += exp(2.0 * particle->weight);
+		sum.total_weight += partials[block].total_weight;
+		sum.squared_weights += partials[block].squared_weights;
+		add_moments(&sum.pos, &partials[block].pos);
+		add_moments(&sum.vel, &partials[block].vel);
+		add_moments(&sum.acc, &partials[block].acc);
+		add_moments(&sum.rotvel, &partials[block].rotvel);
 	}
 
-	return 1.0 / squared_weights;
+	struct estimate *e = &estimate;
+	double total = sum.total_weight;
+	e->total_weight = total;
+	e->effective_particles = total * total / sum.squared_weights;
+	e->mean.pos = finish_moments(&sum.pos, e->mean.pos, total, &e->pos_cov);
+	e->mean.vel = finish_moments(&sum.vel, e->mean.vel, total, &e->vel_cov);
+	e->mean.acc = finish_moments(&sum.acc, e->mean.acc, total, &e->acc_cov);
+	e->mean.rotvel = finish_moments(&sum.rotvel, e->mean.rotvel, total, &e->rotvel_cov);
 }
 
-static void update_state(double delta_t)
+static const struct geodetic_array *block_geodetic(unsigned block)
 {
-	static double on_ground_for, not_on_ground_for;
-	static double deploy_drogue_for, drogue_wait;
-	static double deploy_main_for, main_wait;
+	if(!geodetic_fresh[block])
+	{
+		unsigned begin = block * WORK_BLOCK;
+		unsigned end = begin + WORK_BLOCK < particles->count ? begin + WORK_BLOCK : particles->count;
+		ECEF_to_geodetic_array(&geodetic_cache, &particles->pos, begin, end, GEODETIC_FAST);
+		geodetic_fresh[block] = true;
+	}
+	return &geodetic_cache;
+}
 
-	struct particle *particle;
+/* Must follow any change to the positions of a block's particles */
+static void moved(unsigned block)
+{
+	geodetic_fresh[block] = false;
+}
+
+static double particle_altitude(unsigned i, unsigned block)
+{
+	vec3 pos = vec3_array_get(&particles->pos, i);
+	vec3 d = vec_sub(pos, launch_ltp.origin);
+	if(vec_dot(d, d) <= options.ltp_radius * options.ltp_radius)
+		return LTP_altitude(&launch_ltp, pos);
+	return block_geodetic(block)->altitude[i];
+}
+
+static void check_particle_state(void *unused, unsigned begin, unsigned end, unsigned block)
+{
+	struct rocket_state s;
+	unsigned i;
 	double on_ground = 0;
 	double deploy_drogue = 0;
 	double deploy_main = 0;
+	(void) unused;
 
-	for_each_particle(particle)
+	for(i = begin; i < end; ++i)
 	{
-		double vel = vec_abs(particle->s.vel);
-		double acc = vec_abs(particle->s.acc);
+		s.vel = vec3_array_get(&particles->vel, i);
+		s.acc = vec3_array_get(&particles->acc, i);
+		double vel = vec_abs(s.vel);
+		double acc = vec_abs(s.acc);
 		if(vel <= 2.0 && acc <= 2.0)
-			on_ground += exp(particle->weight);
-		bool going_down = vec_dot(particle->s.pos, particle->s.vel) < 0;
+			on_ground += linear_weight[i];
+		s.pos = vec3_array_get(&particles->pos, i);
+		bool going_down = vec_dot(s.pos, s.vel) < 0;
 		if(state == STATE_FLIGHT && going_down)
 		{
-			bool in_freefall = vec_abs(vec_sub(gravity_acceleration(&particle->s), particle->s.acc)) <= 2.0;
+			bool in_freefall = vec_abs(vec_sub(gravity_acceleration(&gravity, s.pos), s.acc)) <= 2.0;
 			if(in_freefall)
-				deploy_drogue += exp(particle->weight);
-			bool low_altitude = ECEF_to_geodetic(particle->s.pos).altitude - initial_geodetic.altitude <= 500.0;
+				deploy_drogue += linear_weight[i];
+			bool low_altitude = particle_altitude(i, block) - initial_geodetic.altitude <= 500.0;
 			if(low_altitude && vel >= 10.0)
-				deploy_main += exp(particle->weight);
+				deploy_main += linear_weight[i];
 		}
 	}
 
-	hysteresis(&on_ground_for, delta_t, on_ground > 0.5);
-	hysteresis(&not_on_ground_for, delta_t, on_ground <= 0.5);
-	hysteresis(&deploy_drogue_for, delta_t, deploy_drogue > 0.5);
-	hysteresis(&deploy_main_for, delta_t, deploy_main > 0.5);
+	partials[block].on_ground = on_ground;
+	partials[block].deploy_drogue = deploy_drogue;
+	partials[block].deploy_main = deploy_main;
+}
+
+static void update_state(double delta_t)
+{
+	struct timers *t = &timers;
+	unsigned block, blocks = work_blocks(particles->count);
+	double on_ground = 0;
+	double deploy_drogue = 0;
+	double deploy_main = 0;
+
+	workers_run(check_particle_state, NULL, particles->count);
+	for(block = 0; block < blocks; ++block)
+	{
+		on_ground += partials[block].on_ground;
+		deploy_drogue += partials[block].deploy_drogue;
+		deploy_main += partials[block].deploy_main;
+	}
+	on_ground /= estimate.total_weight;
+	deploy_drogue /= estimate.total_weight;
+	deploy_main /= estimate.total_weight;
+
+	hysteresis(&t->on_ground_for, delta_t, on_ground > 0.5);
+	hysteresis(&t->not_on_ground_for, delta_t, on_ground <= 0.5);
+	hysteresis(&t->deploy_drogue_for, delta_t, deploy_drogue > 0.5);
+	hysteresis(&t->deploy_main_for, delta_t, deploy_main > 0.5);
 
 	/* FIXME: check if pointing in the right direction. */
-	can_arm = on_ground_for > 0.25;
+	can_arm = t->on_ground_for > 0.25;
 
-	if(not_on_ground_for > 1.0 && state != STATE_FLIGHT)
+	if(t->not_on_ground_for > 1.0 && state != STATE_FLIGHT)
 		change_state(STATE_FLIGHT);
-	if(on_ground_for > 1.0 && state == STATE_FLIGHT)
+	if(t->on_ground_for > 1.0 && state == STATE_FLIGHT)
 		change_state(STATE_RECOVERY);
 
-	if(ratelimit(&drogue_wait, delta_t, deploy_drogue_for > 0.25))
+	if(ratelimit(&t->drogue_wait, delta_t, t->deploy_drogue_for > 0.25))
 		drogue_chute(true);
-	if(ratelimit(&main_wait, delta_t, deploy_main_for > 0.25))
+	if(ratelimit(&t->main_wait, delta_t, t->deploy_main_for > 0.25))
 		main_chute(true);
 }
 
@@ -178,35 +505,251 @@ static void update_state(double delta_t)
 6) possibly resample
 */
 
+/* Each turn of an attitude quaternion leaves it a rounding error further
+ * from unit length; this many ticks' worth is still far below anything the
+ * sensors could see, so they only get scaled back every so often. */
+#define RENORMALIZE_TICKS 100
+
+struct propagation {
+	double delta_t;
+	bool renormalize;
+};
+
+/* Same integration as integrate_step(), but a field at a time so the
+ * translational update streams through the arrays. */
+static void propagate_particles(void *propagation, unsigned begin, unsigned end, unsigned block)
+{
+	const struct propagation *p = propagation;
+	unsigned i;
+	moved(block);
+	integrate_translation(options.integrator, &particles->pos, &particles->vel, &particles->acc,
+	                      begin, end, p->delta_t);
+	for(i = begin; i < end; ++i)
+	{
+		quat rotation = axis_angle_to_quat(vec_scale(vec3_array_get(&particles->rotvel, i), p->delta_t));
+		quat q = quat_mul(particle_rotpos(particles, i), rotation);
+		particle_set_rotpos(particles, i, p->renormalize ? quat_normalize(q) : q);
+	}
+}
+
+static void gather_particles(void *next, unsigned begin, unsigned end, unsigned block)
+{
+	struct particle_store *dst = next;
+	double weight = -log(dst->count);
+	unsigned i;
+	(void) block;
+	particle_gather(dst, particles, ancestor, begin, end);
+	for(i = begin; i < end; ++i)
+		dst->weight[i] = weight;
+}
+
+/* Size for the next particle set: enough for the bins that particles
+ * likely to survive resampling occupy now. */
+static unsigned adapt_particle_count(void)
+{
+	unsigned bins = count_occupied_bins(particles, kld_pos_bin, kld_vel_bin,
+	                                    log(estimate.total_weight / options.max_particles));
+	unsigned count = kld_sample_size(bins, KLD_EPSILON, KLD_Z);
+	if(count < options.min_particles)
+		return options.min_particles;
+	if(count > options.max_particles)
+		return options.max_particles;
+	return count;
+}
+
 void tick(double delta_t)
 {
-	struct particle *particle;
+	PROFILE_BEGIN(tick_start);
 
-	double effective_particles = normalize_particles();
+	PROFILE_BEGIN(weigh_start);
+	weigh_particles();
+	PROFILE_END(PROFILE_WEIGH, weigh_start);
 
+	PROFILE_BEGIN(state_start);
 	update_state(delta_t);
+	PROFILE_END(PROFILE_STATE, state_start);
 
-	if(effective_particles < 50.0)
+	struct rocket_state centroid = estimate.mean;
+	trace_state("bpf", &centroid, "\n");
+
+	if(estimate.effective_particles < RESAMPLE_THRESHOLD * particles->count)
 	{
-		resample_regular(PARTICLE_COUNT, particles, PARTICLE_COUNT, particle_arrays[!which_particles], 1);
+		PROFILE_BEGIN(resample_start);
+		struct particle_store *next = &particle_stores[!which_particles];
+		next->count = options.adaptive ? adapt_particle_count() : particles->count;
+		struct noise_stream stream;
+		noise_stream_init(&stream, options.seed, noise_draws++, 0);
+		resample(options.resampler, linear_weight, estimate.total_weight,
+		         particles->count, ancestor, next->count, &stream);
+		workers_run(gather_particles, next, next->count);
+		genealogy_record(&genealogy, ancestor, next->count);
 		which_particles = !which_particles;
-		particles = particle_arrays[which_particles];
+		particles = &particle_stores[which_particles];
+		memset(geodetic_fresh, 0, work_blocks(particles->count) * sizeof(*geodetic_fresh));
+		PROFILE_END(PROFILE_RESAMPLE, resample_start);
+	}
+
+	PROFILE_BEGIN(propagate_start);
+	struct propagation propagation = { delta_t, ++ticks_since_renormalize >= RENORMALIZE_TICKS };
+	if(propagation.renormalize)
+		ticks_since_renormalize = 0;
+	workers_run(propagate_particles, &propagation, particles->count);
+	PROFILE_END(PROFILE_PROPAGATE, propagate_start);
+
+	PROFILE_END(PROFILE_TICK, tick_start);
+}
+
+/* A checkpoint is a header, the fixed-size state, every particle field in
+ * turn, and then each generation of the genealogy from the oldest: its
+ * particle count and its ancestors.  Everything is in host byte order and
+ * the layout of this build's structures, so a checkpoint only goes back
+ * into the build that wrote it.  The scratch arrays, the geodetic cache and
+ * the fields init() derives from the launch site are rebuilt rather than
+ * saved. */
+#define CHECKPOINT_MAGIC "PSASFCCP"
+#define CHECKPOINT_VERSION 1
+
+struct checkpoint_header {
+	char magic[8];
+	uint64_t size;
+	uint32_t version;
+	uint32_t particles, generations;
+	uint32_t reserved;
+};
+
+struct checkpoint_state {
+	struct filter_options options;
+	geodetic initial_geodetic;
+	quat initial_rotation;
+	uint64_t noise_draws;
+	struct timers timers;
+	struct estimate estimate;
+	uint32_t state, can_arm, ticks_since_renormalize;
+};
+
+static uint8_t *put(uint8_t *p, const void *src, size_t size)
+{
+	memcpy(p, src, size);
+	return p + size;
+}
+
+static const uint8_t *get(const uint8_t *p, const uint8_t *end, void *dst, size_t size)
+{
+	if(!p || (size_t) (end - p) < size)
+		return NULL;
+	memcpy(dst, p, size);
+	return p + size;
+}
+
+/* Genealogy slot of the generation that many resamples before the newest */
+static unsigned generation_slot(unsigned generations)
+{
+	return (genealogy.newest + genealogy.depth - generations) % genealogy.depth;
+}
+
+size_t checkpoint_size(void)
+{
+	size_t size = sizeof(struct checkpoint_header) + sizeof(struct checkpoint_state) +
+	              (size_t) PARTICLE_FIELDS * particles->count * sizeof(double);
+	unsigned g;
+	for(g = 0; g < genealogy.generations; ++g)
+		size += sizeof(uint32_t) + genealogy.count[generation_slot(g)] * sizeof(unsigned);
+	return size;
+}
+
+void save_checkpoint(void *blob)
+{
+	struct checkpoint_header header = {
+		.magic = CHECKPOINT_MAGIC,
+		.version = CHECKPOINT_VERSION,
+		.size = checkpoint_size(),
+		.particles = particles->count,
+		.generations = genealogy.generations,
+	};
+	struct checkpoint_state fixed;
+	uint8_t *p = blob;
+	unsigned k, g;
+
+	memset(&fixed, 0, sizeof(fixed));
+	fixed.options = options;
+	fixed.initial_geodetic = initial_geodetic;
+	fixed.initial_rotation = initial_rotation;
+	fixed.noise_draws = noise_draws;
+	fixed.timers = timers;
+	fixed.estimate = estimate;
+	fixed.state = state;
+	fixed.can_arm = can_arm;
+	fixed.ticks_since_renormalize = ticks_since_renormalize;
+	p = put(p, &header, sizeof(header));
+	p = put(p, &fixed, sizeof(fixed));
+	for(k = 0; k < PARTICLE_FIELDS; ++k)
+		p = put(p, particle_field(particles, k), particles->count * sizeof(double));
+	for(g = genealogy.generations; g-- > 0; )
+	{
+		unsigned slot = generation_slot(g);
+		uint32_t count = genealogy.count[slot];
+		p = put(p, &count, sizeof(count));
+		p = put(p, genealogy.ancestor + (size_t) slot * genealogy.capacity, count * sizeof(unsigned));
 	}
+}
+
+bool restore_checkpoint(const void *blob, size_t size)
+{
+	struct checkpoint_header header;
+	struct checkpoint_state fixed;
+	const uint8_t *p = blob, *end = p + size;
+	unsigned k, g;
+
+	p = get(p, end, &header, sizeof(header));
+	p = get(p, end, &fixed, sizeof(fixed));
+	if(!p || memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) ||
+	   header.version != CHECKPOINT_VERSION || header.size != size)
+		return false;
 
-	vec3 zero = { 0, 0, 0 };
-	struct rocket_state centroid = { zero, zero, zero, {}, zero };
-	for_each_particle(particle)
+	/* The thread count is the caller's to pick; the filter's output
+	 * doesn't depend on it. */
+	fixed.options.threads = options.threads;
+	options = fixed.options;
+	init(fixed.initial_geodetic, quat_to_mat3(fixed.initial_rotation));
+	if(header.particles < 1 || header.particles > particles->capacity ||
+	   header.generations > genealogy.depth)
+		return false;
+
+	particles->count = header.particles;
+	for(k = 0; k < PARTICLE_FIELDS; ++k)
+		p = get(p, end, particle_field(particles, k), particles->count * sizeof(double));
+	for(g = 0; g < header.generations; ++g)
 	{
-		centroid.pos = vec_add(centroid.pos, vec_scale(particle->s.pos, exp(particle->weight)));
-		centroid.vel = vec_add(centroid.vel, vec_scale(particle->s.vel, exp(particle->weight)));
-		centroid.acc = vec_add(centroid.acc, vec_scale(particle->s.acc, exp(particle->weight)));
-		centroid.rotvel = vec_add(centroid.rotvel, vec_scale(particle->s.rotvel, exp(particle->weight)));
+		uint32_t count;
+		p = get(p, end, &count, sizeof(count));
+		if(!p || count > particles->capacity)
+			return false;
+		p = get(p, end, ancestor, count * sizeof(unsigned));
+		if(!p)
+			return false;
+		genealogy_record(&genealogy, ancestor, count);
 	}
+	if(p != end)
+		return false;
 
-	trace_state("bpf", &centroid, "\n");
+	initial_rotation = fixed.initial_rotation;
+	noise_draws = fixed.noise_draws;
+	timers = fixed.timers;
+	estimate = fixed.estimate;
+	can_arm = fixed.can_arm;
+	ticks_since_renormalize = fixed.ticks_since_renormalize;
+	change_state(fixed.state);
+	return true;
+}
 
-	for_each_particle(particle)
-		update_rocket_state(&particle->s, delta_t);
+unsigned particle_ancestry(unsigned generations, unsigned *lineage)
+{
+	unsigned i;
+	if(generations > genealogy.generations)
+		return 0;
+	for_each_particle(i)
+		lineage[i] = genealogy_trace(&genealogy, generations, i);
+	return particles->count;
 }
 
 void arm(void)
@@ -230,82 +773,122 @@ void launch(void)
 		enqueue_error("Cannot launch: not armed.");
 }
 
+struct accelerometer_measurement {
+	accelerometer_d value;
+	uint64_t draw;
+};
+
+static void accelerometer_update(void *measured, unsigned begin, unsigned end, unsigned block)
+{
+	struct accelerometer_measurement *acc = measured;
+	struct noise_stream s;
+	noise_stream_init(&s, options.seed, acc->draw, block);
+	noise_gaussian(&s, noise.x + begin, end - begin, acc_sd_rel.x);
+	noise_gaussian(&s, noise.y + begin, end - begin, acc_sd_rel.y);
+	noise_gaussian(&s, noise.z + begin, end - begin, acc_sd_rel.z);
+	accelerometer_likelihood(particles, begin, end, &noise, &gravity, acc->value, accelerometer_var);
+}
+
 void accelerometer_sensor(accelerometer_i acc)
 {
-	struct particle *particle;
-	for_each_particle(particle)
-	{
-		vec3 acc_noise = {
-			gaussian(acc_sd_rel.x),
-			gaussian(acc_sd_rel.y),
-			gaussian(acc_sd_rel.z),
-		};
-		particle->s.acc = vec_add(particle->s.acc, rocket_to_ECEF(&particle->s, acc_noise));
-		accelerometer_d local = accelerometer_measurement(&particle->s);
-		particle->weight +=
-			log_gprob(acc.x - local.x, accelerometer_var.x) +
-			log_gprob(acc.y - local.y, accelerometer_var.y) +
-			log_gprob(acc.z - local.z, accelerometer_var.z) +
-			log_gprob(acc.q - local.q, accelerometer_var.q);
-	}
+	struct accelerometer_measurement measured = {
+		{ acc.x, acc.y, acc.z, acc.q },
+		noise_draws++,
+	};
+	PROFILE_BEGIN(start);
+	workers_run(accelerometer_update, &measured, particles->count);
+	PROFILE_END(PROFILE_ACCELEROMETER, start);
+}
+
+static void gyroscope_update(void *measured, unsigned begin, unsigned end, unsigned block)
+{
+	(void) block;
+	gyroscope_likelihood(particles, begin, end, *(vec3 *) measured, gyroscope_var);
 }
 
 void gyroscope_sensor(vec3_i rotvel)
 {
-	struct particle *particle;
-	for_each_particle(particle)
-	{
-		vec3 local = gyroscope_measurement(&particle->s);
-		particle->weight +=
-			log_gprob(rotvel.x - local.x, gyroscope_var.x) +
-			log_gprob(rotvel.y - local.y, gyroscope_var.y) +
-			log_gprob(rotvel.z - local.z, gyroscope_var.z);
-	}
+	vec3 measured = { rotvel.x, rotvel.y, rotvel.z };
+	PROFILE_BEGIN(start);
+	workers_run(gyroscope_update, &measured, particles->count);
+	PROFILE_END(PROFILE_GYROSCOPE, start);
+}
+
+/* Jitters the positions of particles [begin, end) */
+static void add_position_noise(struct noise_stream *s, unsigned begin, unsigned end)
+{
+	struct vec3_array *pos = &particles->pos;
+	noise_add_gaussian(s, pos->x + begin, end - begin, pos_sd.x);
+	noise_add_gaussian(s, pos->y + begin, end - begin, pos_sd.y);
+	noise_add_gaussian(s, pos->z + begin, end - begin, pos_sd.z);
+}
+
+struct gps_measurement {
+	vec3 pos, vel;
+	uint64_t draw;
+};
+
+static void gps_update(void *measured, unsigned begin, unsigned end, unsigned block)
+{
+	struct gps_measurement *gps = measured;
+	struct vec3_array *vel = &particles->vel;
+	struct noise_stream s;
+	noise_stream_init(&s, options.seed, gps->draw, block);
+	add_position_noise(&s, begin, end);
+	moved(block);
+	noise_add_gaussian(&s, vel->x + begin, end - begin, vel_sd.x);
+	noise_add_gaussian(&s, vel->y + begin, end - begin, vel_sd.y);
+	noise_add_gaussian(&s, vel->z + begin, end - begin, vel_sd.z);
+	gps_likelihood(particles, begin, end, gps->pos, gps->vel, gps_pos_var, gps_vel_var);
 }
 
 void gps_sensor(vec3 ecef_pos, vec3 ecef_vel)
 {
-	struct particle *particle;
-	for_each_particle(particle)
-	{
-		particle->s.pos.x += gaussian(pos_sd.x);
-		particle->s.pos.y += gaussian(pos_sd.y);
-		particle->s.pos.z += gaussian(pos_sd.z);
-		particle->s.vel.x += gaussian(vel_sd.x);
-		particle->s.vel.y += gaussian(vel_sd.y);
-		particle->s.vel.z += gaussian(vel_sd.z);
-		particle->weight +=
-			log_gprob(ecef_pos.x - particle->s.pos.x, gps_pos_var.x) +
-			log_gprob(ecef_pos.y - particle->s.pos.y, gps_pos_var.y) +
-			log_gprob(ecef_pos.z - particle->s.pos.z, gps_pos_var.z) +
-			log_gprob(ecef_vel.x - particle->s.vel.x, gps_vel_var.x) +
-			log_gprob(ecef_vel.y - particle->s.vel.y, gps_vel_var.y) +
-			log_gprob(ecef_vel.z - particle->s.vel.z, gps_vel_var.z);
-	}
+	struct gps_measurement measured = { ecef_pos, ecef_vel, noise_draws++ };
+	PROFILE_BEGIN(start);
+	workers_run(gps_update, &measured, particles->count);
+	PROFILE_END(PROFILE_GPS, start);
+}
+
+struct pressure_measurement {
+	double value;
+	uint64_t draw;
+};
+
+static void pressure_update(void *measured, unsigned begin, unsigned end, unsigned block)
+{
+	struct pressure_measurement *pressure = measured;
+	struct noise_stream stream;
+	unsigned i;
+	noise_stream_init(&stream, options.seed, pressure->draw, block);
+	add_position_noise(&stream, begin, end);
+	moved(block);
+	for(i = begin; i < end; ++i)
+		predicted.x[i] = pressure_measurement_at(particle_altitude(i, block));
+	pressure_likelihood(particles, begin, end, predicted.x, pressure->value, pressure_var);
 }
 
 void pressure_sensor(unsigned pressure)
 {
-	struct particle *particle;
-	for_each_particle(particle)
-	{
-		particle->s.pos.x += gaussian(pos_sd.x);
-		particle->s.pos.y += gaussian(pos_sd.y);
-		particle->s.pos.z += gaussian(pos_sd.z);
-		double local = pressure_measurement(&particle->s);
-		particle->weight += log_gprob(pressure - local, pressure_var);
-	}
+	struct pressure_measurement measured = { pressure, noise_draws++ };
+	PROFILE_BEGIN(start);
+	workers_run(pressure_update, &measured, particles->count);
+	PROFILE_END(PROFILE_PRESSURE, start);
+}
+
+static void magnetometer_update(void *measured, unsigned begin, unsigned end, unsigned block)
+{
+	const struct geodetic_array *geodetic = block_geodetic(block);
+	unsigned i;
+	for(i = begin; i < end; ++i)
+		vec3_array_set(&predicted, i, field_cache_lookup(&magnetic_cache, geodetic_array_get(geodetic, i)));
+	magnetometer_likelihood(particles, begin, end, &predicted, *(vec3 *) measured, magnetometer_var);
 }
 
 void magnetometer_sensor(vec3_i mag_vec)
 {
-	struct particle *particle;
-	for_each_particle(particle)
-	{
-		vec3 local = magnetometer_measurement(&particle->s);
-		particle->weight +=
-			log_gprob(mag_vec.x - local.x, magnetometer_var.x) +
-			log_gprob(mag_vec.y - local.y, magnetometer_var.y) +
-			log_gprob(mag_vec.z - local.z, magnetometer_var.z);
-	}
+	vec3 measured = { mag_vec.x, mag_vec.y, mag_vec.z };
+	PROFILE_BEGIN(start);
+	workers_run(magnetometer_update, &measured, particles->count);
+	PROFILE_END(PROFILE_MAGNETOMETER, start);
 }
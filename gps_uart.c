@@ -0,0 +1,151 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#include <stdbool.h>
+#include <string.h>
+
+#include "gps_uart.h"
+
+#define MASK (GPS_UART_RING - 1)
+#define HEADER_LENGTH 10
+
+void gps_uart_init(struct gps_uart *uart)
+{
+	uart->start = uart->length = 0;
+	uart->packet_length = 0;
+	uart->dropped = uart->overflows = uart->overflowed = 0;
+}
+
+static uint8_t byte_at(const struct gps_uart *uart, unsigned offset)
+{
+	return uart->ring[(uart->start + offset) & MASK];
+}
+
+static uint16_t word_at(const struct gps_uart *uart, unsigned offset)
+{
+	return byte_at(uart, offset) | byte_at(uart, offset + 1) << 8;
+}
+
+static void discard(struct gps_uart *uart, unsigned n)
+{
+	uart->start = (uart->start + n) & MASK;
+	uart->length -= n;
+	uart->packet_length = 0;
+}
+
+/* Skips n bytes that don't start a packet */
+static void drop(struct gps_uart *uart, unsigned n)
+{
+	discard(uart, n);
+	uart->dropped += n;
+}
+
+void gps_uart_add(struct gps_uart *uart, const uint8_t *data, size_t n)
+{
+	if(n > GPS_UART_RING - uart->length)
+	{
+		uart->overflows++;
+		uart->overflowed += uart->length;
+		discard(uart, uart->length);
+		if(n > GPS_UART_RING)
+		{
+			uart->overflowed += n - GPS_UART_RING;
+			data += n - GPS_UART_RING;
+			n = GPS_UART_RING;
+		}
+	}
+	unsigned end = (uart->start + uart->length) & MASK;
+	size_t first = GPS_UART_RING - end < n ? GPS_UART_RING - end : n;
+	memcpy(uart->ring + end, data, first);
+	memcpy(uart->ring, data + first, n - first);
+	uart->length += n;
+}
+
+/* Drops everything before the next 0xFF, scanning each contiguous part of
+ * the ring with memchr. */
+static void find_sync(struct gps_uart *uart)
+{
+	unsigned first = GPS_UART_RING - uart->start < uart->length ? GPS_UART_RING - uart->start : uart->length;
+	const uint8_t *p = memchr(uart->ring + uart->start, 0xFF, first);
+	if(p)
+	{
+		drop(uart, p - (uart->ring + uart->start));
+		return;
+	}
+	p = memchr(uart->ring, 0xFF, uart->length - first);
+	drop(uart, p ? first + (unsigned) (p - uart->ring) : uart->length);
+}
+
+/* Looks for a header at start, returning false if more bytes are needed to
+ * tell.  Bad headers are dropped a byte or two at a time, as the sync byte
+ * could turn up again anywhere in them. */
+static bool find_header(struct gps_uart *uart)
+{
+	for(;;)
+	{
+		find_sync(uart);
+		if(uart->length < 2)
+			return false;
+		if(byte_at(uart, 1) != 0x81)
+		{
+			drop(uart, 1);
+			continue;
+		}
+		if(uart->length < HEADER_LENGTH)
+			return false;
+		uint16_t sum = 0;
+		unsigned offset;
+		for(offset = 0; offset < HEADER_LENGTH; offset += 2)
+			sum += word_at(uart, offset);
+		unsigned packet_length = HEADER_LENGTH + 2 * (word_at(uart, 4) + 1);
+		if(sum != 0 || packet_length > GPS_UART_RING)
+		{
+			drop(uart, 2);
+			continue;
+		}
+		uart->packet_length = packet_length;
+		uart->summed = HEADER_LENGTH;
+		uart->sum = 0;
+		return true;
+	}
+}
+
+const uint8_t *gps_uart_next(struct gps_uart *uart, size_t *length)
+{
+	for(;;)
+	{
+		if(!uart->packet_length && !find_header(uart))
+			return NULL;
+
+		/* Sum the data words as they arrive, so a long packet coming in
+		 * a few bytes at a time is only summed once. */
+		unsigned available = uart->length < uart->packet_length ? uart->length : uart->packet_length;
+		for(; uart->summed + 2 <= available; uart->summed += 2)
+			uart->sum += word_at(uart, uart->summed);
+		if(uart->summed < uart->packet_length)
+			return NULL;
+		if(uart->sum != 0)
+		{
+			drop(uart, 2);
+			continue;
+		}
+
+		unsigned n = uart->packet_length;
+		const uint8_t *packet = uart->ring + uart->start;
+		if(uart->start + n > GPS_UART_RING)
+		{
+			unsigned first = GPS_UART_RING - uart->start;
+			memcpy(uart->packet, uart->ring + uart->start, first);
+			memcpy(uart->packet + first, uart->ring, n - first);
+			packet = uart->packet;
+		}
+		uart->start = (uart->start + n) & MASK;
+		uart->length -= n;
+		uart->packet_length = 0;
+		*length = n;
+		return packet;
+	}
+}
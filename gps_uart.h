@@ -0,0 +1,48 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#ifndef GPS_UART_H
+#define GPS_UART_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Must be a power of two, and bounds the longest packet accepted */
+#define GPS_UART_RING 4096
+
+/* Reassembles the GPS receiver's binary packets from its UART stream as it
+ * arrives in pieces: a sync word of 0xFF 0x81, then the message id, data
+ * word count and flags, a header checksum, the data words and a data
+ * checksum, all 16-bit little-endian words summing to zero.  Bytes that
+ * don't start a valid packet are dropped and the stream resynchronized at
+ * the next sync byte. */
+struct gps_uart {
+	uint8_t ring[GPS_UART_RING];
+	/* the oldest byte in the ring, and how many follow it */
+	unsigned start, length;
+	/* the packet at start, once its header checks out, or 0 */
+	unsigned packet_length;
+	/* bytes of that packet summed into sum so far */
+	unsigned summed;
+	uint16_t sum;
+	/* for a packet that wraps around the end of the ring */
+	uint8_t packet[GPS_UART_RING];
+	/* bytes skipped resynchronizing on packets */
+	unsigned long dropped;
+	/* times gps_uart_add() found the ring too full, and the bytes it
+	 * threw away then, whole packets and partial alike */
+	unsigned long overflows, overflowed;
+};
+
+void gps_uart_init(struct gps_uart *uart);
+/* If the ring can't take n more bytes, what it held is thrown away, along
+ * with any of the n beyond the ring's size. */
+void gps_uart_add(struct gps_uart *uart, const uint8_t *data, size_t n);
+/* The next complete packet, or NULL if none has arrived yet.  The packet
+ * stays valid until the next call to either function. */
+const uint8_t *gps_uart_next(struct gps_uart *uart, size_t *length);
+
+#endif /* GPS_UART_H */
@@ -63,8 +63,8 @@ static void init_process(struct state *state)
 
 static void simulate_process(double delta_t, struct state *state)
 {
-	state->vel = vec_add(state->vel, vec_scale(acceleration_axis, gaussian(acceleration_sd) * delta_t));
-	state->pos = vec_add(state->pos, vec_scale(state->vel, delta_t));
+	state->vel = vec_axpy(gaussian(acceleration_sd) * delta_t, acceleration_axis, state->vel);
+	state->pos = vec_axpy(delta_t, state->vel, state->pos);
 }
 
 static double measure_doppler(vec3 pos, vec3 vel, vec3 satpos, vec3 satvel)
@@ -0,0 +1,97 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gravity.h"
+#include "physics.h"
+#include "spherical_harmonics.h"
+#include "data_EGM84.h"
+
+/* WGS84 angular velocity of the earth, radians/second */
+static const double EARTH_ROTATION = 7.292115e-5;
+
+/* Meters between the points the gradient is differenced over */
+static const double GRADIENT_STEP = 100;
+
+static vec3 point_mass(double mu, vec3 pos)
+{
+	double r = vec_abs(pos);
+	return vec_scale(pos, -mu / (r * r * r));
+}
+
+/* The whole model at one position: the gradient of the geopotential,
+ * turned from north, east and down at the geocentric position to ECEF, and
+ * the centrifugal term. */
+static vec3 egm_gravity(const struct spherical_harmonic_model *model, vec3 pos)
+{
+	double horizontal = hypot(pos.x, pos.y);
+	geocentric spherical = {
+		.latitude = atan2(pos.z, horizontal),
+		.longitude = atan2(pos.y, pos.x),
+		.radius = vec_abs(pos),
+	};
+	vec3 g = spherical_harmonic_potential(model, spherical).gradient;
+	double sin_lat = sin(spherical.latitude), cos_lat = cos(spherical.latitude);
+	double sin_lon = sin(spherical.longitude), cos_lon = cos(spherical.longitude);
+	double w2 = EARTH_ROTATION * EARTH_ROTATION;
+	return (vec3) {
+		.x = -(g.x * sin_lat + g.z * cos_lat) * cos_lon - g.y * sin_lon + w2 * pos.x,
+		.y = -(g.x * sin_lat + g.z * cos_lat) * sin_lon + g.y * cos_lon + w2 * pos.y,
+		.z = g.x * cos_lat - g.z * sin_lat,
+	};
+}
+
+static vec3 anomaly(const struct spherical_harmonic_model *model, double mu, vec3 pos)
+{
+	return vec_sub(egm_gravity(model, pos), point_mass(mu, pos));
+}
+
+void gravity_field_init(struct gravity_field *field, enum gravity_model model,
+                        unsigned degree, geodetic site)
+{
+	struct spherical_harmonic_model egm;
+	int axis;
+
+	memset(field, 0, sizeof(*field));
+	field->model = model;
+	field->site = geodetic_to_ECEF(site);
+	if(model != GRAVITY_EGM)
+		return;
+
+	if(degree == 0 || degree > EGM_MAX_DEGREE)
+		degree = EGM_MAX_DEGREE;
+	if(!spherical_harmonic_model_init(&egm, &gravity_coefficients[0][0],
+	                                  EGM_MAX_DEGREE + 1, degree, EGM_RADIUS))
+	{
+		fprintf(stderr, "cannot allocate the gravity model\n");
+		abort();
+	}
+	field->mu = EGM_GM;
+	field->anomaly = anomaly(&egm, field->mu, field->site);
+	for(axis = 0; axis < 3; ++axis)
+	{
+		union vec_array step = { { 0, 0, 0 } };
+		step.component[axis] = GRADIENT_STEP;
+		vec3 d = vec_sub(anomaly(&egm, field->mu, vec_add(field->site, step.vec)),
+		                 anomaly(&egm, field->mu, vec_sub(field->site, step.vec)));
+		field->gradient.component[0][axis] = d.x / (2 * GRADIENT_STEP);
+		field->gradient.component[1][axis] = d.y / (2 * GRADIENT_STEP);
+		field->gradient.component[2][axis] = d.z / (2 * GRADIENT_STEP);
+	}
+	spherical_harmonic_model_free(&egm);
+}
+
+vec3 gravity_acceleration(const struct gravity_field *field, vec3 pos)
+{
+	/* TODO: apply gravity at the approximate center of mass */
+	if(field->model == GRAVITY_POINT_MASS)
+		return vec_scale(pos, -EARTH_GRAVITY / vec_abs(pos));
+	return mat3_vec3_mul_add(&field->gradient, vec_sub(pos, field->site),
+	                         vec_add(point_mass(field->mu, pos), field->anomaly));
+}
@@ -0,0 +1,45 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#ifndef GRAVITY_H
+#define GRAVITY_H
+
+#include "compiler.h"
+#include "coord.h"
+#include "mat.h"
+#include "vec.h"
+
+enum gravity_model {
+	/* EARTH_GRAVITY, straight toward the center of the earth */
+	GRAVITY_POINT_MASS,
+	/* The EGM84 geopotential, plus the centrifugal acceleration of the
+	 * earth's rotation */
+	GRAVITY_EGM,
+};
+
+/* Gravity around a site.  For GRAVITY_EGM this is the attraction of the
+ * earth's mass at its center, plus everything else in the model expanded to
+ * first order about the site: the rest is smooth enough that this stays
+ * within about 3e-4 m/s^2 of the full expansion for a hundred kilometers,
+ * and costs no more than the point mass. */
+struct gravity_field {
+	enum gravity_model model;
+	/* GM, the earth's gravitational constant */
+	double mu;
+	/* ECEF position of the site, and the expanded part there and its
+	 * derivative */
+	vec3 site;
+	vec3 anomaly;
+	mat3 gradient;
+};
+
+/* degree truncates the EGM expansion; 0 uses all of it. */
+void gravity_field_init(struct gravity_field *field, enum gravity_model model,
+                        unsigned degree, geodetic site);
+/* ECEF acceleration due to gravity at an ECEF position */
+vec3 gravity_acceleration(const struct gravity_field *field, vec3 pos) ATTR_WARN_UNUSED_RESULT;
+
+#endif /* GRAVITY_H */
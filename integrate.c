@@ -0,0 +1,288 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#include <math.h>
+#include <stdbool.h>
+
+#include "integrate.h"
+#include "quat.h"
+
+/* Explicit Runge-Kutta methods as Butcher tableaus.  The state is position,
+ * velocity and angular velocity; attitude follows the rotation vector
+ * integrated from angular velocity with the same weights. */
+#define MAX_STAGES 7
+
+struct tableau {
+	unsigned stages;
+	double c[MAX_STAGES];
+	double a[MAX_STAGES][MAX_STAGES];
+	double b[MAX_STAGES];
+	/* b less the weights of the embedded lower-order method */
+	double e[MAX_STAGES];
+	/* whether the last stage is evaluated at the end of the step */
+	bool fsal;
+};
+
+static const struct tableau rk4 = {
+	.stages = 4,
+	.c = { 0, 1.0 / 2, 1.0 / 2, 1 },
+	.a = {
+		{ 0 },
+		{ 1.0 / 2 },
+		{ 0, 1.0 / 2 },
+		{ 0, 0, 1 },
+	},
+	.b = { 1.0 / 6, 1.0 / 3, 1.0 / 3, 1.0 / 6 },
+};
+
+static const struct tableau dormand_prince = {
+	.stages = 7,
+	.c = { 0, 1.0 / 5, 3.0 / 10, 4.0 / 5, 8.0 / 9, 1, 1 },
+	.a = {
+		{ 0 },
+		{ 1.0 / 5 },
+		{ 3.0 / 40, 9.0 / 40 },
+		{ 44.0 / 45, -56.0 / 15, 32.0 / 9 },
+		{ 19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729 },
+		{ 9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176, -5103.0 / 18656 },
+		{ 35.0 / 384, 0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84 },
+	},
+	.b = { 35.0 / 384, 0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84, 0 },
+	.e = {
+		71.0 / 57600, 0, -71.0 / 16695, 71.0 / 1920,
+		-17253.0 / 339200, 22.0 / 525, -1.0 / 40,
+	},
+	.fsal = true,
+};
+
+/* The derivative of the state at one stage */
+struct stage {
+	vec3 vel, acc, rotvel, rotacc;
+};
+
+static struct stage derivative(rocket_rates_fn rates, double t, const struct rocket_state *state)
+{
+	struct rocket_rates r = rates(t, state);
+	return (struct stage) { state->vel, r.acc, state->rotvel, r.rotacc };
+}
+
+/* There's only the one state, so it may as well stay normalized. */
+static void turn(struct rocket_state *state, vec3 rotation)
+{
+	state->rotpos = quat_normalize(quat_mul(state->rotpos, axis_angle_to_quat(rotation)));
+}
+
+/* y plus h times the weighted sum of the first n stages */
+static struct rocket_state combine(const struct rocket_state *y, const struct stage *k,
+                                   const double *weight, unsigned n, double h)
+{
+	struct rocket_state s = *y;
+	vec3 rotation = { 0, 0, 0 };
+	unsigned j;
+	for(j = 0; j < n; ++j)
+	{
+		if(weight[j] == 0)
+			continue;
+		s.pos = vec_axpy(h * weight[j], k[j].vel, s.pos);
+		s.vel = vec_axpy(h * weight[j], k[j].acc, s.vel);
+		s.rotvel = vec_axpy(h * weight[j], k[j].rotacc, s.rotvel);
+		rotation = vec_axpy(h * weight[j], k[j].rotvel, rotation);
+	}
+	turn(&s, rotation);
+	return s;
+}
+
+/* One step of h from y at time t, given the first stage in k[0].  Stores
+ * the new state in out, with its acc and the rotacc at the end in *rotacc,
+ * and returns the larger of the position and velocity error estimates, or
+ * 0 for a tableau without one. */
+static double rk_step(const struct tableau *tableau, rocket_rates_fn rates, double t, double h,
+                      const struct rocket_state *y, struct stage *k,
+                      struct rocket_state *out, vec3 *rotacc)
+{
+	unsigned i;
+	for(i = 1; i < tableau->stages; ++i)
+	{
+		struct rocket_state s = combine(y, k, tableau->a[i], i, h);
+		k[i] = derivative(rates, t + tableau->c[i] * h, &s);
+	}
+	*out = combine(y, k, tableau->b, tableau->stages, h);
+
+	struct stage end = tableau->fsal ? k[tableau->stages - 1] : derivative(rates, t + h, out);
+	out->acc = end.acc;
+	*rotacc = end.rotacc;
+
+	vec3 pos_error = { 0, 0, 0 }, vel_error = { 0, 0, 0 };
+	for(i = 0; i < tableau->stages; ++i)
+	{
+		pos_error = vec_axpy(h * tableau->e[i], k[i].vel, pos_error);
+		vel_error = vec_axpy(h * tableau->e[i], k[i].acc, vel_error);
+	}
+	return fmax(vec_abs(pos_error), vec_abs(vel_error));
+}
+
+void integrate_step(enum integrator integrator, struct rocket_state *state,
+                    double t, double delta_t, rocket_rates_fn rates)
+{
+	struct stage k[MAX_STAGES];
+	vec3 rotacc;
+
+	switch(integrator)
+	{
+	case INTEGRATE_EULER:
+		state->pos = vec_axpy(delta_t, state->vel, state->pos);
+		state->vel = vec_axpy(delta_t, state->acc, state->vel);
+		turn(state, vec_scale(state->rotvel, delta_t));
+		break;
+	case INTEGRATE_LEAPFROG:
+		state->vel = vec_axpy(delta_t / 2, state->acc, state->vel);
+		state->pos = vec_axpy(delta_t, state->vel, state->pos);
+		state->vel = vec_axpy(delta_t / 2, state->acc, state->vel);
+		turn(state, vec_scale(state->rotvel, delta_t));
+		break;
+	case INTEGRATE_RK4:
+	case INTEGRATE_RK45:
+		k[0] = derivative(rates, t, state);
+		rk_step(integrator == INTEGRATE_RK4 ? &rk4 : &dormand_prince,
+		        rates, t, delta_t, state, k, state, &rotacc);
+		break;
+	}
+}
+
+/* One component of integrate_translation() over n particles */
+static void euler(double *pos, double *vel, const double *acc, unsigned n, double delta_t)
+{
+	unsigned i;
+	for(i = 0; i < n; ++i)
+	{
+		pos[i] += vel[i] * delta_t;
+		vel[i] += acc[i] * delta_t;
+	}
+}
+
+static void leapfrog(double *pos, double *vel, const double *acc, unsigned n, double delta_t)
+{
+	unsigned i;
+	for(i = 0; i < n; ++i)
+	{
+		pos[i] += (vel[i] + acc[i] * (delta_t / 2)) * delta_t;
+		vel[i] += acc[i] * delta_t;
+	}
+}
+
+void integrate_translation(enum integrator integrator, struct vec3_array *pos,
+                           struct vec3_array *vel, const struct vec3_array *acc,
+                           unsigned begin, unsigned end, double delta_t)
+{
+	void (*component)(double *, double *, const double *, unsigned, double) =
+		integrator == INTEGRATE_EULER ? euler : leapfrog;
+	component(pos->x + begin, vel->x + begin, acc->x + begin, end - begin, delta_t);
+	component(pos->y + begin, vel->y + begin, acc->y + begin, end - begin, delta_t);
+	component(pos->z + begin, vel->z + begin, acc->z + begin, end - begin, delta_t);
+}
+
+/* Steps never shrink below this, so a discontinuity the caller didn't
+ * reset for can't stall the integrator. */
+static const double MIN_STEP = 1e-6;
+
+void adaptive_init(struct adaptive_integrator *integrator, rocket_rates_fn rates,
+                   double tolerance, double first_step, double max_step)
+{
+	integrator->rates = rates;
+	integrator->tolerance = tolerance;
+	integrator->first_step = first_step;
+	integrator->max_step = max_step;
+	integrator->step = first_step;
+	integrator->steps = integrator->rejected = 0;
+}
+
+void adaptive_reset(struct adaptive_integrator *integrator, double t,
+                    const struct rocket_state *state)
+{
+	struct rocket_rates r = integrator->rates(t, state);
+	integrator->step = integrator->first_step;
+	integrator->t0 = integrator->t1 = t;
+	integrator->s0 = integrator->s1 = *state;
+	integrator->s0.acc = integrator->s1.acc = r.acc;
+	integrator->rotacc0 = integrator->rotacc1 = r.rotacc;
+}
+
+/* Takes the next step from the end of the last one, retrying with smaller
+ * steps until the error estimate is within tolerance. */
+static void adaptive_step(struct adaptive_integrator *integrator)
+{
+	const struct rocket_state *y = &integrator->s1;
+	struct stage k[MAX_STAGES];
+	struct rocket_state next;
+	vec3 rotacc;
+
+	for(;;)
+	{
+		double h = fmin(integrator->step, integrator->max_step);
+		k[0] = (struct stage) { y->vel, y->acc, y->rotvel, integrator->rotacc1 };
+		double error = rk_step(&dormand_prince, integrator->rates, integrator->t1, h,
+		                       y, k, &next, &rotacc) / integrator->tolerance;
+		/* the usual controller for a fifth-order step, kept within a
+		 * factor of five either way */
+		double scale = error > 0 ? 0.9 * pow(error, -0.2) : 5;
+		integrator->step = h * fmin(5, fmax(0.2, scale));
+		if(error <= 1 || h <= MIN_STEP)
+		{
+			integrator->t0 = integrator->t1;
+			integrator->s0 = integrator->s1;
+			integrator->rotacc0 = integrator->rotacc1;
+			integrator->t1 += h;
+			integrator->s1 = next;
+			integrator->rotacc1 = rotacc;
+			integrator->steps++;
+			return;
+		}
+		if(integrator->step < MIN_STEP)
+			integrator->step = MIN_STEP;
+		integrator->rejected++;
+	}
+}
+
+/* Cubic Hermite interpolation from values and derivatives at both ends */
+static vec3 hermite(vec3 p0, vec3 m0, vec3 p1, vec3 m1, double h, double s)
+{
+	double s2 = s * s, s3 = s2 * s;
+	double h00 = 2 * s3 - 3 * s2 + 1, h10 = (s3 - 2 * s2 + s) * h;
+	double h01 = 3 * s2 - 2 * s3, h11 = (s3 - s2) * h;
+	return (vec3) {
+		h00 * p0.x + h10 * m0.x + h01 * p1.x + h11 * m1.x,
+		h00 * p0.y + h10 * m0.y + h01 * p1.y + h11 * m1.y,
+		h00 * p0.z + h10 * m0.z + h01 * p1.z + h11 * m1.z,
+	};
+}
+
+void adaptive_advance(struct adaptive_integrator *integrator, double t,
+                      struct rocket_state *state)
+{
+	while(t > integrator->t1)
+		adaptive_step(integrator);
+
+	const struct rocket_state *s0 = &integrator->s0, *s1 = &integrator->s1;
+	double h = integrator->t1 - integrator->t0;
+	if(t >= integrator->t1 || h <= 0)
+	{
+		*state = *s1;
+		return;
+	}
+
+	/* Cubic Hermite interpolation between the step's endpoints for
+	 * position and velocity, with O(h^4) error: coarser than the O(h^6)
+	 * local error of the fifth-order solution at the endpoints, so it
+	 * leans on the step staying short.  Attitude turns at the mean of the
+	 * angular velocities at either end of the interval. */
+	double s = (t - integrator->t0) / h;
+	*state = *s0;
+	state->pos = hermite(s0->pos, s0->vel, s1->pos, s1->vel, h, s);
+	state->vel = hermite(s0->vel, s0->acc, s1->vel, s1->acc, h, s);
+	state->rotvel = hermite(s0->rotvel, integrator->rotacc0, s1->rotvel, integrator->rotacc1, h, s);
+	turn(state, vec_scale(vec_add(s0->rotvel, state->rotvel), (t - integrator->t0) / 2));
+	state->acc = integrator->rates(t, state).acc;
+}
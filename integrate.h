@@ -0,0 +1,78 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#ifndef INTEGRATE_H
+#define INTEGRATE_H
+
+#include "compiler.h"
+#include "physics.h"
+#include "vec.h"
+
+enum integrator {
+	/* Position from the old velocity, velocity from the acceleration */
+	INTEGRATE_EULER,
+	/* Kick-drift-kick leapfrog: exact while the acceleration is constant */
+	INTEGRATE_LEAPFROG,
+	/* Classic fourth-order Runge-Kutta */
+	INTEGRATE_RK4,
+	/* Dormand-Prince 5(4), with the step chosen to keep the error
+	 * estimate within a tolerance; see struct adaptive_integrator */
+	INTEGRATE_RK45,
+};
+
+/* What moves a rocket: its acceleration and angular acceleration, both in
+ * the frames the rocket_state uses for acc and rotvel */
+struct rocket_rates {
+	vec3 acc, rotacc;
+};
+typedef struct rocket_rates (*rocket_rates_fn)(double t, const struct rocket_state *state);
+
+/* Advances state from time t by delta_t seconds.  Euler and leapfrog take
+ * state->acc as constant over the step and don't call rates; the Runge-Kutta
+ * schemes evaluate it at every stage and leave state->acc at the end of the
+ * step.  Attitude turns by the rotation vector the scheme integrates from
+ * rotvel, which is exact while rotvel is constant. */
+void integrate_step(enum integrator integrator, struct rocket_state *state,
+                    double t, double delta_t, rocket_rates_fn rates);
+
+/* The translational half of integrate_step() for particles [begin, end) of
+ * a particle store, with each acc held constant; the Runge-Kutta schemes
+ * reduce to leapfrog there. */
+void integrate_translation(enum integrator integrator, struct vec3_array *pos,
+                           struct vec3_array *vel, const struct vec3_array *acc,
+                           unsigned begin, unsigned end, double delta_t);
+
+/* Steps Dormand-Prince 5(4) as far as the error estimate allows, up to
+ * max_step, and interpolates between the ends of its last step for the
+ * times a caller asks about.  The estimate is kept within tolerance meters
+ * of position and tolerance meters/second of velocity per step. */
+struct adaptive_integrator {
+	rocket_rates_fn rates;
+	double tolerance, max_step;
+	/* the step to try first after a reset, when the last one says
+	 * nothing about what's ahead */
+	double first_step;
+	/* the step to try next */
+	double step;
+	/* the last step taken, from t0 to t1, and the rates at each end */
+	double t0, t1;
+	struct rocket_state s0, s1;
+	vec3 rotacc0, rotacc1;
+	unsigned long steps, rejected;
+};
+
+void adaptive_init(struct adaptive_integrator *integrator, rocket_rates_fn rates,
+                   double tolerance, double first_step, double max_step);
+/* Starts over from state at time t, discarding the last step: for when the
+ * caller changes the state or its rates outside the integrator. */
+void adaptive_reset(struct adaptive_integrator *integrator, double t,
+                    const struct rocket_state *state);
+/* Fills in state at time t, which must be no earlier than the last reset,
+ * with state->acc evaluated there. */
+void adaptive_advance(struct adaptive_integrator *integrator, double t,
+                      struct rocket_state *state);
+
+#endif /* INTEGRATE_H */
@@ -8,10 +8,14 @@
 #define INTERFACE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "coord.h"
+#include "gravity.h"
+#include "integrate.h"
 #include "physics.h"
+#include "resample.h"
 
 /* Flight computer begins in preflight state. When preflight checks pass
  * and an "arm" command is received, switch to armed state. However, at
@@ -34,7 +38,49 @@ typedef struct vec3_i {
 	uint16_t x, y, z;
 } vec3_i;
 
+/* Tuning for the particle filter, applied by the next init() */
+struct filter_options {
+	/* Seeds every random draw the filter makes.  Given the same seed and
+	 * the same sensor input, the filter's output is bit-identical however
+	 * many threads it runs on. */
+	uint64_t seed;
+	/* Threads to spread the particle loops over, counting the caller */
+	unsigned threads;
+	/* Particles the filter starts with */
+	unsigned particles;
+	/* Resize the particle set at every resample by KLD-sampling, keeping
+	 * it within [min_particles, max_particles] */
+	bool adaptive;
+	unsigned min_particles, max_particles;
+	/* How to draw the new particle set when the weights degenerate */
+	enum resampler resampler;
+	/* Resamples whose ancestor choices are kept for particle_ancestry() */
+	unsigned genealogy;
+	/* Within this many meters of the launch site, particle altitudes come
+	 * from the tangent plane there rather than the full geodetic
+	 * conversion; 0 always uses the full conversion */
+	double ltp_radius;
+	/* The gravity the particles fall under, and the degree to truncate
+	 * GRAVITY_EGM at (0 for all of it) */
+	enum gravity_model gravity;
+	unsigned gravity_degree;
+	/* How particles move between ticks; each particle's acceleration is
+	 * constant over a tick, so anything but Euler is leapfrog */
+	enum integrator integrator;
+};
+
+#define FILTER_OPTIONS_DEFAULT { \
+	.threads = 1, \
+	.particles = 1000, \
+	.min_particles = 250, \
+	.max_particles = 50000, \
+	.resampler = RESAMPLE_SYSTEMATIC, \
+	.ltp_radius = 20000, \
+	.integrator = INTEGRATE_LEAPFROG, \
+}
+
 /* Implemented by the flight computer */
+void set_filter_options(const struct filter_options *options);
 void init(geodetic initial_geodetic_in, mat3 initial_rotation_in);
 void tick(double delta_t);
 void arm(void);
@@ -44,6 +90,19 @@ void gyroscope_sensor(vec3_i rotvel);
 void magnetometer_sensor(vec3_i mag_vec);
 void gps_sensor(vec3 ecef_pos, vec3 ecef_vel);
 void pressure_sensor(unsigned pressure);
+/* For fixed-lag smoothing: stores in lineage, for each current particle, the
+ * index it had the given number of resamples ago.  Returns the particle count, or 0
+ * if the genealogy option doesn't reach back that far. */
+unsigned particle_ancestry(unsigned generations, unsigned *lineage);
+/* Checkpoints of the whole filter: particles, state and timers.
+ * save_checkpoint() writes checkpoint_size() bytes to blob;
+ * restore_checkpoint() stands in for init() and puts the filter back as it
+ * was, keeping only the thread count from set_filter_options().  It returns
+ * false for a blob this build didn't write, after which the filter needs
+ * init() again. */
+size_t checkpoint_size(void);
+void save_checkpoint(void *blob);
+bool restore_checkpoint(const void *blob, size_t size);
 
 /* Implemented by the driver harness */
 void trace_state(const char *source, struct rocket_state *state, const char *fmt, ...) ATTR_FORMAT(printf,3,4);
@@ -0,0 +1,202 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#include <math.h>
+
+#include "likelihood.h"
+#include "physics.h"
+#include "simd.h"
+
+/* The kernels below mirror the scalar models in sensors.c and gprob.h; keep
+ * them in step. */
+
+#if SIMD_WIDTH > PARTICLE_ALIGN
+#error "particle arrays are not padded enough for this SIMD width"
+#endif
+
+typedef struct vvec3 {
+	vdouble x, y, z;
+} vvec3;
+
+static inline vvec3 vvec3_load(const struct vec3_array *a, unsigned i)
+{
+	return (vvec3) { vload(a->x + i), vload(a->y + i), vload(a->z + i) };
+}
+
+static inline void vvec3_store(struct vec3_array *a, unsigned i, vvec3 v)
+{
+	vstore(a->x + i, v.x);
+	vstore(a->y + i, v.y);
+	vstore(a->z + i, v.z);
+}
+
+typedef struct vquat {
+	vdouble w, x, y, z;
+} vquat;
+
+static inline vquat load_rotpos(const struct particle_store *p, unsigned i)
+{
+	return (vquat) {
+		vload(p->rotpos[0] + i), vload(p->rotpos[1] + i),
+		vload(p->rotpos[2] + i), vload(p->rotpos[3] + i),
+	};
+}
+
+static inline vvec3 vcross(vvec3 a, vvec3 b)
+{
+	return (vvec3) {
+		a.y * b.z - a.z * b.y,
+		a.z * b.x - a.x * b.z,
+		a.x * b.y - a.y * b.x,
+	};
+}
+
+/* v turned by the rotation q, as mat3_vec3_mul(quat_to_mat3(q), v) but
+ * without building the matrix: v + 2w(u x v) + 2u x (u x v) */
+static inline vvec3 quat_rotate(vdouble w, vvec3 u, vvec3 v)
+{
+	vvec3 t = vcross(u, v);
+	t = (vvec3) { t.x + t.x, t.y + t.y, t.z + t.z };
+	vvec3 c = vcross(u, t);
+	return (vvec3) { v.x + w * t.x + c.x, v.y + w * t.y + c.y, v.z + w * t.z + c.z };
+}
+
+/* ECEF_to_rocket() */
+static inline vvec3 rotate(vquat q, vvec3 v)
+{
+	return quat_rotate(q.w, (vvec3) { q.x, q.y, q.z }, v);
+}
+
+/* rocket_to_ECEF(), turning the other way */
+static inline vvec3 rotate_transpose(vquat q, vvec3 v)
+{
+	return quat_rotate(q.w, (vvec3) { -q.x, -q.y, -q.z }, v);
+}
+
+static inline vdouble log_vgprob(vdouble delta, double variance)
+{
+	return delta * delta * (-0.5 / variance);
+}
+
+static inline vdouble log_vgprob3(vvec3 delta, vec3 variance)
+{
+	return log_vgprob(delta.x, variance.x) +
+	       log_vgprob(delta.y, variance.y) +
+	       log_vgprob(delta.z, variance.z);
+}
+
+/* gravity_acceleration() */
+static inline vvec3 vgravity(const struct gravity_field *field, vvec3 pos)
+{
+	vdouble r = vsqrt(pos.x * pos.x + pos.y * pos.y + pos.z * pos.z);
+	if(field->model == GRAVITY_POINT_MASS)
+	{
+		vdouble g = -EARTH_GRAVITY / r;
+		return (vvec3) { pos.x * g, pos.y * g, pos.z * g };
+	}
+	const mat3 *m = &field->gradient;
+	vdouble g = -field->mu / (r * r * r);
+	vvec3 d = { pos.x - field->site.x, pos.y - field->site.y, pos.z - field->site.z };
+	return (vvec3) {
+		pos.x * g + field->anomaly.x + m->x1 * d.x + m->y1 * d.y + m->z1 * d.z,
+		pos.y * g + field->anomaly.y + m->x2 * d.x + m->y2 * d.y + m->z2 * d.z,
+		pos.z * g + field->anomaly.z + m->x3 * d.x + m->y3 * d.y + m->z3 * d.z,
+	};
+}
+
+void accelerometer_likelihood(struct particle_store *p, unsigned begin, unsigned end,
+                              const struct vec3_array *noise, const struct gravity_field *gravity,
+                              accelerometer_d measured, accelerometer_d variance)
+{
+	const accelerometer_d bias = ACCELEROMETER_BIAS;
+	const accelerometer_d gain = ACCELEROMETER_GAIN;
+	unsigned i;
+	for(i = begin; i < end; i += SIMD_WIDTH)
+	{
+		vquat r = load_rotpos(p, i);
+		vvec3 acc = vvec3_load(&p->acc, i);
+		vvec3 n = rotate_transpose(r, vvec3_load(noise, i));
+		acc.x += n.x;
+		acc.y += n.y;
+		acc.z += n.z;
+		vvec3_store(&p->acc, i, acc);
+
+		vvec3 g = vgravity(gravity, vvec3_load(&p->pos, i));
+		vvec3 rocket = rotate(r, (vvec3) { acc.x - g.x, acc.y - g.y, acc.z - g.z });
+
+		vdouble weight = vload(p->weight + i);
+		weight += log_vgprob(measured.x - (rocket.x * gain.x + bias.x), variance.x);
+		weight += log_vgprob(measured.y - (rocket.y * gain.y + bias.y), variance.y);
+		weight += log_vgprob(measured.z - (rocket.z * gain.z + bias.z), variance.z);
+		weight += log_vgprob(measured.q - ((rocket.x + rocket.y) * (M_SQRT1_2 * gain.q) + bias.q), variance.q);
+		vstore(p->weight + i, weight);
+	}
+}
+
+void gyroscope_likelihood(struct particle_store *p, unsigned begin, unsigned end,
+                          vec3 measured, vec3 variance)
+{
+	const vec3 bias = GYROSCOPE_BIAS;
+	const vec3 gain = GYROSCOPE_GAIN;
+	unsigned i;
+	for(i = begin; i < end; i += SIMD_WIDTH)
+	{
+		vquat r = load_rotpos(p, i);
+		vvec3 rocket = rotate(r, vvec3_load(&p->rotvel, i));
+		vvec3 delta = {
+			measured.x - (rocket.x * gain.x + bias.x),
+			measured.y - (rocket.y * gain.y + bias.y),
+			measured.z - (rocket.z * gain.z + bias.z),
+		};
+		vstore(p->weight + i, vload(p->weight + i) + log_vgprob3(delta, variance));
+	}
+}
+
+void magnetometer_likelihood(struct particle_store *p, unsigned begin, unsigned end,
+                             const struct vec3_array *field,
+                             vec3 measured, vec3 variance)
+{
+	const vec3 bias = MAGNETOMETER_BIAS;
+	const vec3 gain = MAGNETOMETER_GAIN;
+	unsigned i;
+	for(i = begin; i < end; i += SIMD_WIDTH)
+	{
+		vquat r = load_rotpos(p, i);
+		vvec3 sensor = rotate_transpose(r, vvec3_load(field, i));
+		vvec3 delta = {
+			measured.x - (sensor.x * gain.x + bias.x),
+			measured.y - (sensor.y * gain.y + bias.y),
+			measured.z - (sensor.z * gain.z + bias.z),
+		};
+		vstore(p->weight + i, vload(p->weight + i) + log_vgprob3(delta, variance));
+	}
+}
+
+void gps_likelihood(struct particle_store *p, unsigned begin, unsigned end,
+                    vec3 pos, vec3 vel, vec3 pos_variance, vec3 vel_variance)
+{
+	unsigned i;
+	for(i = begin; i < end; i += SIMD_WIDTH)
+	{
+		vvec3 ppos = vvec3_load(&p->pos, i);
+		vvec3 pvel = vvec3_load(&p->vel, i);
+		vvec3 dpos = { pos.x - ppos.x, pos.y - ppos.y, pos.z - ppos.z };
+		vvec3 dvel = { vel.x - pvel.x, vel.y - pvel.y, vel.z - pvel.z };
+		vstore(p->weight + i, vload(p->weight + i) +
+		       log_vgprob3(dpos, pos_variance) +
+		       log_vgprob3(dvel, vel_variance));
+	}
+}
+
+void pressure_likelihood(struct particle_store *p, unsigned begin, unsigned end,
+                         const double *predicted,
+                         double measured, double variance)
+{
+	unsigned i;
+	for(i = begin; i < end; i += SIMD_WIDTH)
+		vstore(p->weight + i, vload(p->weight + i) +
+		       log_vgprob(measured - vload(predicted + i), variance));
+}
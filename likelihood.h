@@ -0,0 +1,38 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#ifndef LIKELIHOOD_H
+#define LIKELIHOOD_H
+
+#include "gravity.h"
+#include "particle.h"
+#include "sensors.h"
+
+/* Batched measurement updates.  Each kernel evaluates the predicted sensor
+ * reading for SIMD_WIDTH particles at a time and adds the Gaussian log
+ * likelihood of the actual reading to their weights.  They cover particles
+ * [begin, end), where begin must be a multiple of SIMD_WIDTH; end may be
+ * rounded up into the store's padding. */
+
+/* noise is in the rocket frame and is added to each particle's acceleration
+ * before it is measured. */
+void accelerometer_likelihood(struct particle_store *p, unsigned begin, unsigned end,
+                              const struct vec3_array *noise, const struct gravity_field *gravity,
+                              accelerometer_d measured, accelerometer_d variance);
+void gyroscope_likelihood(struct particle_store *p, unsigned begin, unsigned end,
+                          vec3 measured, vec3 variance);
+/* field is the Earth's magnetic field at each particle. */
+void magnetometer_likelihood(struct particle_store *p, unsigned begin, unsigned end,
+                             const struct vec3_array *field,
+                             vec3 measured, vec3 variance);
+void gps_likelihood(struct particle_store *p, unsigned begin, unsigned end,
+                    vec3 pos, vec3 vel, vec3 pos_variance, vec3 vel_variance);
+/* predicted is the pressure sensor reading expected at each particle. */
+void pressure_likelihood(struct particle_store *p, unsigned begin, unsigned end,
+                         const double *predicted,
+                         double measured, double variance);
+
+#endif /* LIKELIHOOD_H */
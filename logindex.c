@@ -0,0 +1,141 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+
+/* Converts a logger's flight log on standard input to the indexed format
+ * (see canlog.h) on standard output, for lv2log to seek through. */
+#include <stdlib.h>
+#include <string.h>
+
+#include "canlog.h"
+
+#define CAN_IDS 2048
+
+static uint32_t id[CANLOG_CHUNK], timestamp[CANLOG_CHUNK];
+static uint8_t data[CANLOG_CHUNK][8];
+static unsigned count;
+
+static struct canlog_chunk *chunk;
+static struct canlog_directory_entry *directory;
+static uint32_t chunks, chunk_capacity, directory_entries, directory_capacity;
+static uint32_t latest_timestamp;
+static uint64_t offset;
+
+static void *grow(void *array, uint32_t *capacity, uint32_t needed, size_t element)
+{
+	if(needed <= *capacity)
+		return array;
+	*capacity = needed > 2 * *capacity ? needed : 2 * *capacity;
+	if(!(array = realloc(array, *capacity * element)))
+	{
+		fprintf(stderr, "cannot allocate %u index entries\n", (unsigned) *capacity);
+		abort();
+	}
+	return array;
+}
+
+static void put(const void *p, size_t size)
+{
+	if(size && fwrite(p, size, 1, stdout) != 1)
+	{
+		perror("logindex: write");
+		exit(EXIT_FAILURE);
+	}
+	offset += size;
+}
+
+static void flush_chunk(void)
+{
+	static uint32_t per_id[CAN_IDS];
+	unsigned i;
+	struct canlog_chunk *c;
+
+	if(!count)
+		return;
+	chunk = grow(chunk, &chunk_capacity, chunks + 1, sizeof(*chunk));
+	c = &chunk[chunks++];
+	c->offset = offset;
+	c->count = count;
+	c->first_timestamp = 0;
+	c->directory = directory_entries;
+	memset(per_id, 0, sizeof(per_id));
+	for(i = 0; i < count; ++i)
+	{
+		per_id[(id[i] >> 5) & (CAN_IDS - 1)]++;
+		if(!timestamp[i])
+			continue;
+		if(!c->first_timestamp)
+			c->first_timestamp = timestamp[i];
+		if(timestamp[i] > latest_timestamp)
+			latest_timestamp = timestamp[i];
+	}
+	c->last_timestamp = latest_timestamp;
+	for(i = 0; i < CAN_IDS; ++i)
+	{
+		if(!per_id[i])
+			continue;
+		directory = grow(directory, &directory_capacity, directory_entries + 1, sizeof(*directory));
+		directory[directory_entries++] = (struct canlog_directory_entry) {
+			.identifier = i,
+			.count = per_id[i],
+		};
+	}
+	c->identifiers = directory_entries - c->directory;
+
+	put(id, count * sizeof(*id));
+	put(timestamp, count * sizeof(*timestamp));
+	put(data, count * sizeof(*data));
+	count = 0;
+}
+
+int main(void)
+{
+	static struct canlog log;
+	static struct canlog_batch batch;
+	struct canlog_header header = {
+		.magic = CANLOG_MAGIC,
+		.byte_order = CANLOG_BYTE_ORDER,
+		.version = CANLOG_VERSION,
+	};
+	struct canlog_trailer trailer = { .magic = CANLOG_MAGIC };
+
+	if(!canlog_open(&log, stdin))
+		return EXIT_FAILURE;
+	if(log.chunk)
+	{
+		fprintf(stderr, "logindex: input is indexed already\n");
+		return EXIT_FAILURE;
+	}
+	put(&header, sizeof(header));
+	while(canlog_read(&log, &batch))
+	{
+		unsigned i;
+		for(i = 0; i < batch.count; ++i)
+		{
+			id[count] = batch.id[i];
+			timestamp[count] = batch.timestamp[i];
+			memcpy(data[count], canlog_data(&batch, i), sizeof(data[count]));
+			if(++count == CANLOG_CHUNK)
+				flush_chunk();
+		}
+	}
+	flush_chunk();
+	canlog_close(&log);
+
+	trailer.directory_offset = offset;
+	trailer.directory_entries = directory_entries;
+	put(directory, directory_entries * sizeof(*directory));
+	trailer.chunk_offset = offset;
+	trailer.chunks = chunks;
+	put(chunk, chunks * sizeof(*chunk));
+	put(&trailer, sizeof(trailer));
+	if(fflush(stdout))
+	{
+		perror("logindex: write");
+		return EXIT_FAILURE;
+	}
+	return 0;
+}
@@ -4,26 +4,41 @@
  * This program is licensed under the GPL version 2 or later.  Please see the
  * file COPYING in the source distribution of this software for license terms.
  */
-#include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <arpa/inet.h>
 
 #include "binary.h"
+#include "canlog.h"
 #include "interface.h"
 #include "gps.h"
+#include "gps_uart.h"
 #include "sim-common.h"
 
 static bool processed_message = false;
 static uint32_t last_timestamp;
 static struct gps_navigation_buffer channels[32];
 
+/* --start and --end limit the replay to a window of the flight; resuming
+ * from a checkpoint starts the window where it was taken */
+static uint32_t window_start, window_end = UINT32_MAX;
+
 static double to_seconds(uint32_t timestamp)
 {
 	return timestamp / 100.0;
 }
 
+static uint32_t from_seconds(const char *seconds)
+{
+	double timestamp = strtod(seconds, NULL) * 100;
+	if(timestamp <= 0)
+		return 0;
+	if(timestamp >= UINT32_MAX)
+		return UINT32_MAX;
+	return timestamp;
+}
+
 double current_timestamp(void)
 {
 	return to_seconds(last_timestamp);
@@ -85,30 +100,16 @@ static void add_navigation_word(uint8_t prn, uint16_t offset, uint32_t word)
 	}
 }
 
-static size_t consume_gps(uint8_t gps_buffer[], size_t gps_length)
+/* A packet gps_uart_next() has checked the framing and checksums of */
+static void process_gps(const uint8_t gps_buffer[], size_t gps_length)
 {
 	static vec3 lastpos;
 	static vec3 lastvel;
-	if (gps_length < 10)
-		return 0;
-	if (gps_buffer[0] != 0xFF || gps_buffer[1] != 0x81)
-		return 1;
-	uint16_t sum = 0;
-	size_t sum_word;
-	for (sum_word = 0; sum_word < 5; ++sum_word)
-		sum += read16le(gps_buffer + sum_word * 2);
-	if (sum != 0)
-		return 2;
-	uint16_t word_count = read16le(gps_buffer + 4) + 1;
-	if (gps_length < 10U + word_count * 2U)
-		return 0;
-	for (; sum_word < 5U + word_count; ++sum_word)
-		sum += read16le(gps_buffer + sum_word * 2);
-	if (sum != 0)
-		return 2;
 	switch (read16le(gps_buffer + 2))
 	{
 	case 1009: ;
+		if (gps_length < 42)
+			break;
 		vec3 pos = {
 			.x = (int32_t) read32le(gps_buffer + 18) / 100.0,
 			.y = (int32_t) read32le(gps_buffer + 22) / 100.0,
@@ -126,12 +127,14 @@ static size_t consume_gps(uint8_t gps_buffer[], size_t gps_length)
 		processed_message = true;
 		break;
 	case 1102: ;
+		if (gps_length < (24 + 19 * 12) * 2)
+			break;
 		uint32_t gps_time_int = read32le(gps_buffer + 16);
 		int32_t gps_time_frac = read32le(gps_buffer + 20);
 		double gps_time = gps_time_int * 2.0 / 100.0 + gps_time_frac / 50.0 / (1 << 29);
 		for (int i = 0; i < 12; ++i)
 		{
-			uint8_t *base = gps_buffer + (24 + 19 * i) * 2;
+			const uint8_t *base = gps_buffer + (24 + 19 * i) * 2;
 			uint16_t prn = read16le(base + 3 * 2);
 			if (prn == 0 || prn > 32)
 				continue;
@@ -164,84 +167,288 @@ static size_t consume_gps(uint8_t gps_buffer[], size_t gps_length)
 		}
 		break;
 	}
-	return 10 + 2 * word_count;
 }
 
-struct canmsg_t {
-	uint32_t        id;             /* id<<5 + rtr<<4 + len */
-	uint32_t        timestamp;
-	unsigned char   data[8];
+static struct gps_uart gps_uart;
+
+/* Each CAN message type the log may hold: its 11-bit identifier, its
+ * payload length (or ANY_LENGTH), and the decoder for its payload.
+ * Decoders of sensor readings return true, so that the filter ticks once
+ * their timestamp is done. */
+#define ANY_LENGTH 0xFF
+
+struct can_message_type {
+	uint16_t id;
+	uint8_t length;
+	const char *name;
+	bool (*decode)(const uint8_t *data, unsigned length);
+};
+
+static bool decode_request_state(const uint8_t *data, unsigned length)
+{
+	(void) length;
+	if(data[0] == /* ArmingState */ 5)
+		arm();
+	return false;
+}
+
+static bool decode_rocket_ready(const uint8_t *data, unsigned length)
+{
+	(void) length;
+	/* We approximate launch time as the time LV2 indicated readiness to
+	 * launch. */
+	if(data[0] == 1)
+		launch();
+	return false;
+}
+
+static bool decode_set_pyro(const uint8_t *data, unsigned length)
+{
+	(void) length;
+	if(data[0] == 1)
+		trace_printf("LV2 fired drogue chute pyro\n");
+	if(data[0] == 3)
+		trace_printf("LV2 fired main chute pyro\n");
+	return false;
+}
+
+static bool decode_accel(const uint8_t *data, unsigned length)
+{
+	(void) length;
+	accelerometer_sensor((accelerometer_i) {
+		.x = read16be(data + 0),
+		.y = read16be(data + 2),
+		.z = read16be(data + 4),
+		.q = read16be(data + 6),
+	});
+	return true;
+}
+
+static vec3_i read_vec3_i(const uint8_t *data)
+{
+	return (vec3_i) {
+		.x = read16be(data + 0),
+		.y = read16be(data + 2),
+		.z = read16be(data + 4),
+	};
+}
+
+static bool decode_gyro(const uint8_t *data, unsigned length)
+{
+	(void) length;
+	gyroscope_sensor(read_vec3_i(data));
+	return true;
+}
+
+static bool decode_mag(const uint8_t *data, unsigned length)
+{
+	(void) length;
+	magnetometer_sensor(read_vec3_i(data));
+	return true;
+}
+
+static bool decode_pressure(const uint8_t *data, unsigned length)
+{
+	(void) length;
+	pressure_sensor(read16be(data));
+	return true;
+}
+
+/* Fixes come out of process_gps() as their packets complete. */
+static bool decode_gps_uart(const uint8_t *data, unsigned length)
+{
+	const uint8_t *packet;
+	size_t packet_length;
+	gps_uart_add(&gps_uart, data, length);
+	while((packet = gps_uart_next(&gps_uart, &packet_length)))
+		process_gps(packet, packet_length);
+	return false;
+}
+
+static const struct can_message_type message_types[] = {
+	{ 0x001, 1, "FC_REQUEST_STATE", decode_request_state },
+	{ 0x040, 2, "REC_SET_PYRO", decode_set_pyro },
+	{ 0x192, 1, "UMB_SET_ROCKETREADY", decode_rocket_ready },
+	{ 0x0DC, 8, "IMU_ACCEL_DATA", decode_accel },
+	{ 0x319, 2, "PRESS_REPORT_DATA", decode_pressure },
+	{ 0x298, ANY_LENGTH, "GPS_UART_TRANSMIT", decode_gps_uart },
 };
 
+/* FIXME: the gyro and magnetometer identifiers and payloads are guessed
+ * from IMU_ACCEL_DATA's: three big-endian 16-bit words, each holding a
+ * 12-bit reading.  Until they're checked against the LV2 CAN ID list they
+ * are only decoded with --assume-imu-ids, so a wrong guess can't quietly
+ * feed some other message to the filter. */
+static const struct can_message_type assumed_message_types[] = {
+	{ 0x0DD, 6, "IMU_GYRO_DATA", decode_gyro },
+	{ 0x0DE, 6, "IMU_MAG_DATA", decode_mag },
+};
+static bool assume_imu_ids;
+
+#define CAN_IDS 2048
+
+/* message_types indexed by identifier, and how many of each the log held */
+static const struct can_message_type *dispatch[CAN_IDS];
+static unsigned long message_count[CAN_IDS];
+static unsigned long undecoded_count[CAN_IDS];
+
+static void init_dispatch(void)
+{
+	unsigned i;
+	for(i = 0; i < sizeof(message_types) / sizeof(*message_types); ++i)
+		dispatch[message_types[i].id] = &message_types[i];
+	if(assume_imu_ids)
+		for(i = 0; i < sizeof(assumed_message_types) / sizeof(*assumed_message_types); ++i)
+			dispatch[assumed_message_types[i].id] = &assumed_message_types[i];
+}
+
+/* Everything of lv2log's own a checkpoint carries.  A checkpoint is taken
+ * as the first record of a new timestamp arrives, before it's processed, so
+ * resuming replays the log from the first record stamped at or after
+ * last_timestamp; that picks up exactly where the checkpoint left off
+ * unless the logger's clock stepped back across it. */
+struct lv2log_checkpoint {
+	uint32_t last_timestamp;
+	bool processed_message;
+	struct gps_navigation_buffer channels[32];
+	struct gps_uart gps_uart;
+	unsigned long message_count[CAN_IDS];
+	unsigned long undecoded_count[CAN_IDS];
+};
+
+static void save_lv2log_checkpoint(void)
+{
+	static struct lv2log_checkpoint c;
+	c.last_timestamp = last_timestamp;
+	c.processed_message = processed_message;
+	memcpy(c.channels, channels, sizeof(c.channels));
+	c.gps_uart = gps_uart;
+	memcpy(c.message_count, message_count, sizeof(c.message_count));
+	memcpy(c.undecoded_count, undecoded_count, sizeof(c.undecoded_count));
+	write_checkpoint(&c, sizeof(c));
+}
+
+static bool resume_lv2log_checkpoint(void)
+{
+	static struct lv2log_checkpoint c;
+	if(!resume_checkpoint(&c, sizeof(c)))
+		return false;
+	last_timestamp = c.last_timestamp;
+	processed_message = c.processed_message;
+	memcpy(channels, c.channels, sizeof(channels));
+	gps_uart = c.gps_uart;
+	memcpy(message_count, c.message_count, sizeof(message_count));
+	memcpy(undecoded_count, c.undecoded_count, sizeof(undecoded_count));
+	return true;
+}
+
+static void process_message(uint32_t id, uint32_t timestamp, const uint8_t data[8])
+{
+	if(timestamp != 0 && processed_message && last_timestamp != timestamp)
+	{
+		if(last_timestamp)
+			tick(to_seconds(timestamp - last_timestamp));
+		poll_profile();
+		last_timestamp = timestamp;
+		processed_message = false;
+		if(checkpoint_due())
+			save_lv2log_checkpoint();
+	}
+	unsigned can_id = (id >> 5) & (CAN_IDS - 1);
+	bool rtr = id & 0x10;
+	unsigned length = id & 0xF;
+	const struct can_message_type *type = dispatch[can_id];
+	message_count[can_id]++;
+	if(!type || rtr || length > 8 ||
+	   (type->length == ANY_LENGTH ? length == 0 : length != type->length))
+	{
+		undecoded_count[can_id]++;
+		return;
+	}
+	if(type->decode(data, length))
+		processed_message = true;
+}
+
+static void print_message_counts(void)
+{
+	unsigned i;
+	for(i = 0; i < CAN_IDS; ++i)
+	{
+		if(!message_count[i])
+			continue;
+		if(dispatch[i])
+			trace_printf("CAN %#05x %-20s %lu messages, %lu not decoded\n",
+			             i, dispatch[i]->name, message_count[i], undecoded_count[i]);
+		else
+			trace_printf("CAN %#05x %-20s %lu messages\n", i, "unknown", message_count[i]);
+	}
+}
+
+static void parse_lv2log_args(int argc, const char *const argv[])
+{
+	int i;
+	for(i = 1; i < argc; i++)
+	{
+		if(!strncmp(argv[i], "--start=", 8))
+			window_start = from_seconds(argv[i] + 8);
+		else if(!strncmp(argv[i], "--end=", 6))
+			window_end = from_seconds(argv[i] + 6);
+		else if(!strcmp(argv[i], "--assume-imu-ids"))
+			assume_imu_ids = true;
+	}
+}
+
 int main(int argc, const char *const argv[])
 {
 	parse_trace_args(argc, argv);
+	parse_lv2log_args(argc, argv);
 	/* Hardcoded because we can't extract it from the log. */
 	initial_geodetic = (geodetic) {
 		.latitude = 43.79575081,
 		.longitude = -120.65137954,
 		.altitude = 1373.46,
 	};
-	init(initial_geodetic, make_LTP_rotation(initial_geodetic));
+	set_filter_options(&filter_options);
+	gps_uart_init(&gps_uart);
+	init_dispatch();
+	if(resume_lv2log_checkpoint())
+		window_start = last_timestamp;
+	else
+		init(initial_geodetic, make_LTP_rotation(initial_geodetic));
 
-	struct canmsg_t msg;
-	uint8_t gps_buffer[4096];
-	size_t gps_length = 0;
-	while(fread(&msg, sizeof(msg), 1, stdin) == 1)
+	static struct canlog log;
+	static struct canlog_batch batch;
+	bool in_window = false, past_window = false;
+	if(!canlog_open(&log, stdin))
+		return EXIT_FAILURE;
+	/* Only an indexed log can skip ahead; a logger's log is read from
+	 * the start and everything before the window dropped. */
+	if(window_start)
+		canlog_seek(&log, window_start);
+	while(!past_window && canlog_read(&log, &batch))
 	{
-		msg.id = ntohl(msg.id);
-		msg.timestamp = ntohl(msg.timestamp);
-		if(msg.timestamp != 0 && processed_message && last_timestamp != msg.timestamp)
+		unsigned i;
+		for(i = 0; i < batch.count; ++i)
 		{
-			if(last_timestamp)
-				tick(to_seconds(msg.timestamp - last_timestamp));
-			last_timestamp = msg.timestamp;
-			processed_message = false;
-		}
-		size_t length = msg.id & 0xF;
-		switch(msg.id)
-		{
-		case /* FC_REQUEST_STATE */ 0x0021:
-			if(msg.data[0] == /* ArmingState */ 5)
-				arm();
-			break;
-		case /* UMB_SET_ROCKETREADY */ 0x3241:
-			/* We approximate launch time as the time LV2 indicated
-			 * readiness to launch. */
-			if(msg.data[0] == 1)
-				launch();
-			break;
-		case /* IMU_ACCEL_DATA */ 0x1B88:
-			accelerometer_sensor((accelerometer_i) {
-				.x = read16be(msg.data + 0),
-				.y = read16be(msg.data + 2),
-				.z = read16be(msg.data + 4),
-				.q = read16be(msg.data + 6),
-			});
-			processed_message = true;
-			break;
-		case /* PRESS_REPORT_DATA */ 0x6322:
-			pressure_sensor(read16be(msg.data));
-			processed_message = true;
-			break;
-		case /* REC_SET_PYRO */ 0x0802:
-			if(msg.data[0] == 1)
-				trace_printf("LV2 fired drogue chute pyro\n");
-			if(msg.data[0] == 3)
-				trace_printf("LV2 fired main chute pyro\n");
-			break;
-		case /* GPS_UART_TRANSMIT */ 0x5301 ... 0x5308:
-			assert (gps_length + length < sizeof(gps_buffer));
-			memcpy(gps_buffer + gps_length, msg.data, length);
-			gps_length += length;
-			while((length = consume_gps(gps_buffer, gps_length)))
+			uint32_t timestamp = batch.timestamp[i];
+			if(timestamp > window_end)
 			{
-				gps_length -= length;
-				memmove(gps_buffer, gps_buffer + length, gps_length);
+				past_window = true;
+				break;
 			}
-			break;
+			if(timestamp >= window_start)
+				in_window = true;
+			if(in_window)
+				process_message(batch.id[i], timestamp, canlog_data(&batch, i));
 		}
 	}
+	canlog_close(&log);
+	print_message_counts();
+	if(gps_uart.dropped)
+		trace_printf("GPS: dropped %lu bytes resynchronizing\n", gps_uart.dropped);
+	if(gps_uart.overflows)
+		trace_printf("GPS: ring overflowed %lu times, discarding %lu bytes\n",
+		             gps_uart.overflows, gps_uart.overflowed);
 
 	return 0;
 }
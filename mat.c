@@ -5,7 +5,6 @@
  * file COPYING in the source distribution of this software for license terms.
  */
 #include <math.h>
-#include <string.h>
 #include "mat.h"
 #include "vec.h"
 
@@ -45,35 +44,3 @@ mat3 axis_angle_to_mat3(vec3 axis_angle)
 
 	return dst;
 }
-
-mat3 mat3_mul(mat3 left, mat3 right)
-{
-	mat3 tmp = { };
-	int i, j, k;
-	for(i = 0; i < 3; ++i)
-		for(j = 0; j < 3; ++j)
-			for(k = 0; k < 3; ++k)
-				tmp.component[i][j] += left.component[i][k] * right.component[k][j];
-	return tmp;
-}
-
-vec3 mat3_vec3_mul(mat3 left, vec3 right)
-{
-	union vec_array right_array = { right };
-	union vec_array tmp = { };
-	int i, k;
-	for(i = 0; i < 3; ++i)
-		for(k = 0; k < 3; ++k)
-			tmp.component[i] += left.component[i][k] * right_array.component[k];
-	return tmp.vec;
-}
-
-mat3 mat3_transpose(mat3 m)
-{
-	mat3 tmp;
-	int i, j;
-	for(i = 0; i < 3; ++i)
-		for(j = 0; j < 3; ++j)
-			tmp.component[j][i] = m.component[i][j];
-	return tmp;
-}
@@ -21,8 +21,74 @@ typedef union mat3
 } mat3;
 
 mat3 axis_angle_to_mat3(vec3 axis_angle) ATTR_WARN_UNUSED_RESULT;
-mat3 mat3_mul(mat3 left, mat3 right) ATTR_WARN_UNUSED_RESULT;
-vec3 mat3_vec3_mul(mat3 left, vec3 right) ATTR_WARN_UNUSED_RESULT;
-mat3 mat3_transpose(mat3 m) ATTR_WARN_UNUSED_RESULT;
+
+/* The rest are inline, as in vec.h.  The matrices are passed by pointer so
+ * that nothing is copied even where a call isn't inlined. */
+static inline mat3 mat3_mul(const mat3 *left, const mat3 *right) ATTR_WARN_UNUSED_RESULT;
+static inline vec3 mat3_vec3_mul(const mat3 *left, vec3 right) ATTR_WARN_UNUSED_RESULT;
+static inline mat3 mat3_transpose(const mat3 *m) ATTR_WARN_UNUSED_RESULT;
+/* transpose(left) * right, without building the transpose */
+static inline vec3 mat3_transpose_vec3_mul(const mat3 *left, vec3 right) ATTR_WARN_UNUSED_RESULT;
+/* left * right + add, and transpose(left) * right + add */
+static inline vec3 mat3_vec3_mul_add(const mat3 *left, vec3 right, vec3 add) ATTR_WARN_UNUSED_RESULT;
+static inline vec3 mat3_transpose_vec3_mul_add(const mat3 *left, vec3 right, vec3 add) ATTR_WARN_UNUSED_RESULT;
+
+static inline mat3 mat3_mul(const mat3 *left, const mat3 *right)
+{
+	mat3 tmp;
+	int i, j;
+	for(i = 0; i < 3; ++i)
+		for(j = 0; j < 3; ++j)
+			tmp.component[i][j] = left->component[i][0] * right->component[0][j] +
+			                      left->component[i][1] * right->component[1][j] +
+			                      left->component[i][2] * right->component[2][j];
+	return tmp;
+}
+
+static inline vec3 mat3_vec3_mul_add(const mat3 *left, vec3 right, vec3 add)
+{
+	return (vec3) {
+		.x = left->x1 * right.x + left->y1 * right.y + left->z1 * right.z + add.x,
+		.y = left->x2 * right.x + left->y2 * right.y + left->z2 * right.z + add.y,
+		.z = left->x3 * right.x + left->y3 * right.y + left->z3 * right.z + add.z
+	};
+}
+
+static inline vec3 mat3_transpose_vec3_mul_add(const mat3 *left, vec3 right, vec3 add)
+{
+	return (vec3) {
+		.x = left->x1 * right.x + left->x2 * right.y + left->x3 * right.z + add.x,
+		.y = left->y1 * right.x + left->y2 * right.y + left->y3 * right.z + add.y,
+		.z = left->z1 * right.x + left->z2 * right.y + left->z3 * right.z + add.z
+	};
+}
+
+static inline vec3 mat3_vec3_mul(const mat3 *left, vec3 right)
+{
+	return (vec3) {
+		.x = left->x1 * right.x + left->y1 * right.y + left->z1 * right.z,
+		.y = left->x2 * right.x + left->y2 * right.y + left->z2 * right.z,
+		.z = left->x3 * right.x + left->y3 * right.y + left->z3 * right.z
+	};
+}
+
+static inline vec3 mat3_transpose_vec3_mul(const mat3 *left, vec3 right)
+{
+	return (vec3) {
+		.x = left->x1 * right.x + left->x2 * right.y + left->x3 * right.z,
+		.y = left->y1 * right.x + left->y2 * right.y + left->y3 * right.z,
+		.z = left->z1 * right.x + left->z2 * right.y + left->z3 * right.z
+	};
+}
+
+static inline mat3 mat3_transpose(const mat3 *m)
+{
+	mat3 tmp;
+	int i, j;
+	for(i = 0; i < 3; ++i)
+		for(j = 0; j < 3; ++j)
+			tmp.component[j][i] = m->component[i][j];
+	return tmp;
+}
 
 #endif /* MAT_H */
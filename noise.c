@@ -0,0 +1,135 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#include <math.h>
+#include <string.h>
+
+#include "noise.h"
+
+/* Counters run through Philox this many at a time.  The lanes are
+ * independent, so the compiler can keep them in vector registers. */
+#define NOISE_LANES 32
+/* Each lane yields 128 bits: two 53-bit uniforms */
+#define NOISE_BATCH (2 * NOISE_LANES)
+
+#define PHILOX_M0 UINT64_C(0xD2511F53)
+#define PHILOX_M1 UINT64_C(0xCD9E8D57)
+#define PHILOX_W0 UINT32_C(0x9E3779B9)
+#define PHILOX_W1 UINT32_C(0xBB67AE85)
+#define PHILOX_ROUNDS 10
+
+void noise_stream_init(struct noise_stream *s, uint64_t seed, uint64_t stream, uint32_t substream)
+{
+	s->key[0] = seed;
+	s->key[1] = seed >> 32;
+	s->stream = stream;
+	s->substream = substream;
+	s->position = 0;
+}
+
+/* The counter of lane i is (position + i, substream, stream) */
+static void philox(struct noise_stream *s, double u[NOISE_BATCH])
+{
+	uint32_t c0[NOISE_LANES], c1[NOISE_LANES], c2[NOISE_LANES], c3[NOISE_LANES];
+	uint32_t k0 = s->key[0], k1 = s->key[1];
+	int i, round;
+
+	for(i = 0; i < NOISE_LANES; ++i)
+	{
+		c0[i] = s->position + i;
+		c1[i] = s->substream;
+		c2[i] = s->stream;
+		c3[i] = s->stream >> 32;
+	}
+	s->position += NOISE_LANES;
+
+	for(round = 0; round < PHILOX_ROUNDS; ++round)
+	{
+		for(i = 0; i < NOISE_LANES; ++i)
+		{
+			uint64_t p0 = PHILOX_M0 * c0[i];
+			uint64_t p1 = PHILOX_M1 * c2[i];
+			uint32_t hi0 = p0 >> 32, hi1 = p1 >> 32;
+			c0[i] = hi1 ^ c1[i] ^ k0;
+			c1[i] = p1;
+			c2[i] = hi0 ^ c3[i] ^ k1;
+			c3[i] = p0;
+		}
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+
+	/* 53 bits from each pair of words, offset by half a step so that
+	   neither 0 nor 1 comes out; the pieces convert as signed ints */
+	for(i = 0; i < NOISE_LANES; ++i)
+	{
+		int32_t a0 = c0[i] >> 6, b0 = c1[i] >> 5;
+		int32_t a1 = c2[i] >> 6, b1 = c3[i] >> 5;
+		u[i] = a0 * 0x1p-26 + (b0 + 0.5) * 0x1p-53;
+		u[i + NOISE_LANES] = a1 * 0x1p-26 + (b1 + 0.5) * 0x1p-53;
+	}
+}
+
+void noise_uniform(struct noise_stream *s, double *out, unsigned n)
+{
+	double u[NOISE_BATCH];
+	while(n >= NOISE_BATCH)
+	{
+		philox(s, out);
+		out += NOISE_BATCH;
+		n -= NOISE_BATCH;
+	}
+	if(n)
+	{
+		philox(s, u);
+		memcpy(out, u, n * sizeof(*out));
+	}
+}
+
+/* Box-Muller: each pair of uniforms makes a pair of normals.  The sine is
+ * taken from the cosine so the loop only calls functions that have vector
+ * versions. */
+static void gaussian_batch(struct noise_stream *s, double g[NOISE_BATCH], double sd)
+{
+	double u[NOISE_BATCH];
+	int i;
+	philox(s, u);
+	for(i = 0; i < NOISE_LANES; ++i)
+	{
+		double r = sd * sqrt(-2.0 * log(u[i]));
+		double c = cos(2.0 * M_PI * u[i + NOISE_LANES]);
+		g[i] = r * c;
+		g[i + NOISE_LANES] = copysign(r * sqrt(1.0 - c * c), 0.5 - u[i + NOISE_LANES]);
+	}
+}
+
+void noise_gaussian(struct noise_stream *s, double *out, unsigned n, double sd)
+{
+	double g[NOISE_BATCH];
+	while(n >= NOISE_BATCH)
+	{
+		gaussian_batch(s, out, sd);
+		out += NOISE_BATCH;
+		n -= NOISE_BATCH;
+	}
+	if(n)
+	{
+		gaussian_batch(s, g, sd);
+		memcpy(out, g, n * sizeof(*out));
+	}
+}
+
+void noise_add_gaussian(struct noise_stream *s, double *x, unsigned n, double sd)
+{
+	double g[NOISE_BATCH];
+	unsigned i, k;
+	for(i = 0; i < n; i += NOISE_BATCH)
+	{
+		gaussian_batch(s, g, sd);
+		for(k = 0; k < NOISE_BATCH && i + k < n; ++k)
+			x[i + k] += g[k];
+	}
+}
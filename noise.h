@@ -0,0 +1,34 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <stdint.h>
+
+/* Batched random numbers from the Philox4x32-10 counter-based generator
+ * (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3", 2011).
+ * Every output is a pure function of the seed, a 64-bit stream number, a
+ * 32-bit substream number and its position, so there is no shared state: a
+ * worker can open the substream for the block of particles it was handed
+ * and draw the same numbers whichever thread runs it. */
+
+struct noise_stream {
+	uint32_t key[2];
+	uint64_t stream;
+	uint32_t substream;
+	uint32_t position;
+};
+
+void noise_stream_init(struct noise_stream *s, uint64_t seed, uint64_t stream, uint32_t substream);
+/* Fills out with n uniform numbers in (0, 1). */
+void noise_uniform(struct noise_stream *s, double *out, unsigned n);
+/* Fills out with n normal numbers with mean 0 and the given deviation. */
+void noise_gaussian(struct noise_stream *s, double *out, unsigned n, double sd);
+/* Adds normal noise with the given deviation to each of the n numbers in x. */
+void noise_add_gaussian(struct noise_stream *s, double *x, unsigned n, double sd);
+
+#endif /* NOISE_H */
@@ -0,0 +1,142 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "particle.h"
+
+static size_t padded(unsigned capacity)
+{
+	return (capacity + PARTICLE_ALIGN - 1) / PARTICLE_ALIGN * PARTICLE_ALIGN;
+}
+
+/* Scratch vectors get the same layout as one field group of the store */
+bool vec3_array_init(struct vec3_array *a, unsigned capacity)
+{
+	size_t stride = padded(capacity);
+	double *block;
+	if(posix_memalign((void **) &block, PARTICLE_ALIGN * sizeof(double),
+	                  3 * stride * sizeof(double)))
+		return false;
+	memset(block, 0, 3 * stride * sizeof(double));
+	a->x = block;
+	a->y = block + stride;
+	a->z = block + 2 * stride;
+	return true;
+}
+
+void vec3_array_free(struct vec3_array *a)
+{
+	free(a->x);
+	memset(a, 0, sizeof(*a));
+}
+
+bool particle_store_init(struct particle_store *store, unsigned capacity)
+{
+	size_t stride = padded(capacity);
+	double *block;
+	int i;
+
+	if(posix_memalign((void **) &block, PARTICLE_ALIGN * sizeof(double),
+	                  PARTICLE_FIELDS * stride * sizeof(double)))
+		return false;
+	memset(block, 0, PARTICLE_FIELDS * stride * sizeof(double));
+
+	store->count = store->capacity = capacity;
+	store->stride = stride;
+	store->block = block;
+	store->weight = block; block += stride;
+	store->pos.x = block; block += stride;
+	store->pos.y = block; block += stride;
+	store->pos.z = block; block += stride;
+	store->vel.x = block; block += stride;
+	store->vel.y = block; block += stride;
+	store->vel.z = block; block += stride;
+	store->acc.x = block; block += stride;
+	store->acc.y = block; block += stride;
+	store->acc.z = block; block += stride;
+	for(i = 0; i < 4; ++i)
+	{
+		store->rotpos[i] = block;
+		block += stride;
+	}
+	store->rotvel.x = block; block += stride;
+	store->rotvel.y = block; block += stride;
+	store->rotvel.z = block;
+	return true;
+}
+
+void particle_store_free(struct particle_store *store)
+{
+	free(store->block);
+	memset(store, 0, sizeof(*store));
+}
+
+/* Every field is the same distance apart in the block, so whole particles
+ * can be moved without naming each field.  Going field by field keeps each
+ * pass down to one source and one destination array. */
+void particle_gather(struct particle_store *dst, const struct particle_store *src,
+                     const unsigned *ancestor, unsigned begin, unsigned end)
+{
+	int k;
+	for(k = 0; k < PARTICLE_FIELDS; ++k)
+	{
+		double *d = (double *) dst->block + k * dst->stride;
+		const double *s = (const double *) src->block + k * src->stride;
+		unsigned i;
+		for(i = begin; i < end; ++i)
+			d[i] = s[ancestor[i]];
+	}
+}
+
+bool genealogy_init(struct genealogy *g, unsigned depth, unsigned capacity)
+{
+	memset(g, 0, sizeof(*g));
+	if(!(g->count = calloc(depth, sizeof(*g->count))) ||
+	   !(g->ancestor = malloc((size_t) depth * capacity * sizeof(*g->ancestor))))
+	{
+		genealogy_free(g);
+		return false;
+	}
+	g->depth = depth;
+	g->capacity = capacity;
+	return true;
+}
+
+void genealogy_free(struct genealogy *g)
+{
+	free(g->count);
+	free(g->ancestor);
+	memset(g, 0, sizeof(*g));
+}
+
+void genealogy_clear(struct genealogy *g)
+{
+	g->generations = g->newest = 0;
+}
+
+void genealogy_record(struct genealogy *g, const unsigned *ancestor, unsigned count)
+{
+	if(!g->depth)
+		return;
+	g->newest = (g->newest + 1) % g->depth;
+	g->count[g->newest] = count;
+	memcpy(g->ancestor + (size_t) g->newest * g->capacity, ancestor, count * sizeof(*ancestor));
+	if(g->generations < g->depth)
+		g->generations++;
+}
+
+unsigned genealogy_trace(const struct genealogy *g, unsigned generations, unsigned i)
+{
+	unsigned slot = g->newest;
+	while(generations--)
+	{
+		i = g->ancestor[(size_t) slot * g->capacity + i];
+		slot = (slot + g->depth - 1) % g->depth;
+	}
+	return i;
+}
@@ -7,12 +7,96 @@
 #ifndef PARTICLE_H
 #define PARTICLE_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include "physics.h"
 
-struct particle
+/* The particle set is stored as a structure of arrays: every field of every
+ * particle lives in its own contiguous array, so a loop that only needs the
+ * position (say) only pulls positions through the cache.  Each array starts
+ * on a cache line boundary and is padded to a whole number of cache lines, so
+ * batched kernels may run past the last particle up to the padding. */
+
+#define PARTICLE_ALIGN 8
+
+/* weight, pos, vel, acc, rotpos, rotvel */
+#define PARTICLE_FIELDS (1 + 3 + 3 + 3 + 4 + 3)
+
+struct particle_store
 {
-	double weight;
-	struct rocket_state s;
+	unsigned count, capacity;
+	size_t stride;
+	double *weight;
+	struct vec3_array pos, vel, acc;
+	/* the w, x, y and z components of the attitude quaternion */
+	double *rotpos[4];
+	struct vec3_array rotvel;
+	void *block;
 };
 
+bool vec3_array_init(struct vec3_array *a, unsigned capacity) ATTR_WARN_UNUSED_RESULT;
+void vec3_array_free(struct vec3_array *a);
+/* The store starts out full; count may later be set anywhere up to capacity. */
+bool particle_store_init(struct particle_store *store, unsigned capacity) ATTR_WARN_UNUSED_RESULT;
+void particle_store_free(struct particle_store *store);
+/* Fills particles [begin, end) of dst with the particles of src named by
+ * ancestor, one field at a time. */
+void particle_gather(struct particle_store *dst, const struct particle_store *src,
+                     const unsigned *ancestor, unsigned begin, unsigned end);
+
+/* The ancestor arrays of the last few resamples, newest first, so that the
+ * lineage of today's particles can be traced back for fixed-lag smoothing. */
+struct genealogy
+{
+	unsigned depth, capacity;
+	unsigned generations, newest;
+	unsigned *count;
+	unsigned *ancestor;
+};
+
+bool genealogy_init(struct genealogy *g, unsigned depth, unsigned capacity) ATTR_WARN_UNUSED_RESULT;
+void genealogy_free(struct genealogy *g);
+void genealogy_clear(struct genealogy *g);
+void genealogy_record(struct genealogy *g, const unsigned *ancestor, unsigned count);
+/* Index particle i had the given number of resamples ago, which must be no
+ * more than g->generations. */
+unsigned genealogy_trace(const struct genealogy *g, unsigned generations, unsigned i);
+
+/* Field k of every particle, counting in the order above */
+static inline double *particle_field(const struct particle_store *store, unsigned k)
+{
+	return (double *) store->block + k * store->stride;
+}
+
+static inline quat particle_rotpos(const struct particle_store *store, unsigned i)
+{
+	return (quat) { store->rotpos[0][i], store->rotpos[1][i], store->rotpos[2][i], store->rotpos[3][i] };
+}
+
+static inline void particle_set_rotpos(struct particle_store *store, unsigned i, quat q)
+{
+	store->rotpos[0][i] = q.w;
+	store->rotpos[1][i] = q.x;
+	store->rotpos[2][i] = q.y;
+	store->rotpos[3][i] = q.z;
+}
+
+static inline void particle_get_state(const struct particle_store *store, unsigned i, struct rocket_state *state)
+{
+	state->pos = vec3_array_get(&store->pos, i);
+	state->vel = vec3_array_get(&store->vel, i);
+	state->acc = vec3_array_get(&store->acc, i);
+	state->rotpos = particle_rotpos(store, i);
+	state->rotvel = vec3_array_get(&store->rotvel, i);
+}
+
+static inline void particle_set_state(struct particle_store *store, unsigned i, const struct rocket_state *state)
+{
+	vec3_array_set(&store->pos, i, state->pos);
+	vec3_array_set(&store->vel, i, state->vel);
+	vec3_array_set(&store->acc, i, state->acc);
+	particle_set_rotpos(store, i, state->rotpos);
+	vec3_array_set(&store->rotvel, i, state->rotvel);
+}
+
 #endif /* PARTICLE_H */
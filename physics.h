@@ -11,11 +11,12 @@
 #include <stdbool.h>
 #include "compiler.h"
 #include "mat.h"
+#include "quat.h"
 #include "vec.h"
 
 typedef uint64_t microseconds;
 
-/* Gravity constant */
+/* Gravity constant, for the point-mass model in gravity.h */
 static const double EARTH_GRAVITY = 9.8;
 
 /* Thrust constants */
@@ -27,14 +28,11 @@ static const microseconds ENGINE_BURN_TIME = 4300000;
 struct rocket_state
 {
 	vec3 pos, vel, acc;  /* Earth-centered Earth-fixed */
-	mat3 rotpos;         /* Launch-centered Earth-fixed */
+	quat rotpos;         /* Launch-centered Earth-fixed */
 	vec3 rotvel;         /* Launch-centered Earth-fixed */
 };
 
 vec3 ECEF_to_rocket(struct rocket_state *rocket_state, vec3 v) ATTR_WARN_UNUSED_RESULT;
 vec3 rocket_to_ECEF(const struct rocket_state *rocket_state, vec3 v) ATTR_WARN_UNUSED_RESULT;
-vec3 gravity_acceleration(const struct rocket_state *rocket_state) ATTR_WARN_UNUSED_RESULT;
-void update_rocket_state(struct rocket_state *rocket_state, double delta_t);
-void update_rocket_state_sim(struct rocket_state *rocket_state, double delta_t, vec3 (*f)(double, const struct rocket_state*), double t);
 
 #endif
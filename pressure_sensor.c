@@ -22,6 +22,8 @@
  */
 
 #include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include "pressure_sensor.h"
 /* lapse rate and base altitude for each layer in the atmosphere */
 static const double lapse_rate[NUMBER_OF_LAYERS] =
@@ -29,43 +31,203 @@ static const double lapse_rate[NUMBER_OF_LAYERS] =
 static const double base_altitude[NUMBER_OF_LAYERS] =
      {0, 11000, 20000, 32000, 47000, 51000, 71000};
 
-
-/* Base temperature and pressure for each layer in the atmosphere. The values
- * given are the default, calculated from LAYER0_BASE_PRESSURE and
- * LAYER0_BASE_TEMPERATURE. The values are recalculated in a call to
- * init_atmosphere()
+/* Base temperature and pressure for each layer in the atmosphere,
+ * calculated by init_atmosphere() from the temperature and pressure at the
+ * base of the lowest layer.  Until it's called they come from
+ * LAYER0_BASE_TEMPERATURE and LAYER0_BASE_PRESSURE.
  */
-static double base_pressure[NUMBER_OF_LAYERS] = {1.013250e+05, 2.263206e+04,
-                        5.474885e+03, 8.680176e+02, 1.109061e+02, 6.693875e+01};
-static double base_temperature[NUMBER_OF_LAYERS]= {2.881500e+02, 2.166500e+02,
-                        2.166500e+02, 2.286500e+02, 2.706500e+02, 2.706500e+02};
+static double base_pressure[NUMBER_OF_LAYERS];
+static double base_temperature[NUMBER_OF_LAYERS];
 
-void init_atmosphere(double ground_temperature, double ground_pressure){
-    //TODO: accept altitude where measurements were taken, also humidity
+/* The lowest layer's tables reach this far below its base; other altitudes
+ * and pressures outside the tables use the formulas directly. */
+#define LOWEST_ALTITUDE -1000.0
+
+/* Each layer gets two cubic Hermite tables with this many intervals:
+ * pressure at evenly spaced altitudes, and altitude at evenly spaced
+ * pressures.  Both functions are smooth within a layer and their exact
+ * derivatives are cheap, so the interpolation error is tiny; init_atmosphere()
+ * measures it at every interval's midpoint, where it peaks, and only uses
+ * the tables if it's within the tolerances below. */
+#define TABLE_INTERVALS 512
+static const double PRESSURE_TOLERANCE = 1e-9; /* relative */
+static const double ALTITUDE_TOLERANCE = 1e-3; /* meters */
+
+struct hermite_table {
+   double start, end, inverse_step;
+   /* values, and derivatives times the step, at each end of each interval */
+   double value[TABLE_INTERVALS + 1];
+   double slope[TABLE_INTERVALS + 1];
+};
+
+static struct hermite_table pressure_table[NUMBER_OF_LAYERS];
+static struct hermite_table altitude_table[NUMBER_OF_LAYERS];
+static bool tables_verified;
+static pthread_once_t default_atmosphere = PTHREAD_ONCE_INIT;
+
+static double layer_bottom(int layer_number)
+{
+   return layer_number == 0 ? LOWEST_ALTITUDE : base_altitude[layer_number];
+}
+
+static double layer_top(int layer_number)
+{
+   return layer_number == NUMBER_OF_LAYERS - 1 ? MAXIMUM_ALTITUDE : base_altitude[layer_number + 1];
+}
+
+static int altitude_layer(double altitude)
+{
+   int layer_number;
+   for(layer_number = 0; layer_number < NUMBER_OF_LAYERS - 1 && altitude > base_altitude[layer_number + 1]; ++layer_number)
+       /* empty */;
+   return layer_number;
+}
+
+static int pressure_layer(double pressure)
+{
+   int layer_number;
+   for(layer_number = 0; layer_number < NUMBER_OF_LAYERS - 1 && pressure < base_pressure[layer_number + 1]; ++layer_number)
+       /* empty */;
+   return layer_number;
+}
+
+static double layer_temperature(int layer_number, double altitude)
+{
+   return base_temperature[layer_number] + (altitude - base_altitude[layer_number]) * lapse_rate[layer_number];
+}
+
+/* pressure at the given altitude, within the given layer */
+static double layer_pressure(int layer_number, double altitude)
+{
+   double base; /* base for function to determine pressure */
+   double exponent; /* exponent for function to determine pressure */
+   double delta_z = altitude - base_altitude[layer_number];
+
+   if (lapse_rate[layer_number] == 0.0) {
+      exponent = GRAVITATIONAL_ACCELERATION * delta_z
+           / AIR_GAS_CONSTANT / base_temperature[layer_number];
+      return base_pressure[layer_number] * exp(exponent);
+   }
+   base = (lapse_rate[layer_number] * delta_z / base_temperature[layer_number]) + 1.0;
+   exponent = GRAVITATIONAL_ACCELERATION /
+        (AIR_GAS_CONSTANT * lapse_rate[layer_number]);
+   return base_pressure[layer_number] * pow(base, exponent);
+}
+
+/* altitude of the given pressure, within the given layer */
+static double layer_altitude(int layer_number, double pressure)
+{
+   double base, exponent, coefficient;
+
+   if (lapse_rate[layer_number] == 0.0) {
+      coefficient = (AIR_GAS_CONSTANT / GRAVITATIONAL_ACCELERATION)
+                                                    * base_temperature[layer_number];
+      return base_altitude[layer_number]
+                    + coefficient * log(pressure / base_pressure[layer_number]);
+   }
+   base = pressure / base_pressure[layer_number];
+   exponent = AIR_GAS_CONSTANT * lapse_rate[layer_number]
+                                    / GRAVITATIONAL_ACCELERATION;
+   coefficient = base_temperature[layer_number] / lapse_rate[layer_number];
+   return base_altitude[layer_number]
+                   + coefficient * (pow(base, exponent) - 1);
+}
+
+/* The hydrostatic equation gives both derivatives:
+ * dp/dz = p g / (R T), and dz/dp is its reciprocal. */
+static double pressure_slope(int layer_number, double altitude, double pressure)
+{
+   return pressure * GRAVITATIONAL_ACCELERATION
+        / (AIR_GAS_CONSTANT * layer_temperature(layer_number, altitude));
+}
+
+static double hermite(const struct hermite_table *table, double x)
+{
+   double t = (x - table->start) * table->inverse_step;
+   int i = (int) t;
+   if (i > TABLE_INTERVALS - 1)
+      i = TABLE_INTERVALS - 1;
+   t -= i;
+
+   double p0 = table->value[i], p1 = table->value[i + 1];
+   double m0 = table->slope[i], m1 = table->slope[i + 1];
+   return p0 + t * (m0 + t * (3 * (p1 - p0) - 2 * m0 - m1 + t * (2 * (p0 - p1) + m0 + m1)));
+}
+
+/* Fills both of a layer's tables and returns whether they're within the
+ * tolerances */
+static bool build_tables(int layer_number)
+{
+   struct hermite_table *forward = &pressure_table[layer_number];
+   struct hermite_table *inverse = &altitude_table[layer_number];
+   double bottom = layer_bottom(layer_number), top = layer_top(layer_number);
+   double high = layer_pressure(layer_number, bottom), low = layer_pressure(layer_number, top);
+   double z_step = (top - bottom) / TABLE_INTERVALS;
+   double p_step = (high - low) / TABLE_INTERVALS;
+   bool ok = true;
+   int i;
+
+   forward->start = bottom;
+   forward->end = top;
+   forward->inverse_step = 1 / z_step;
+   inverse->start = low;
+   inverse->end = high;
+   inverse->inverse_step = 1 / p_step;
+   for(i = 0; i <= TABLE_INTERVALS; ++i) {
+      double z = bottom + i * z_step;
+      double p = layer_pressure(layer_number, z);
+      forward->value[i] = p;
+      forward->slope[i] = pressure_slope(layer_number, z, p) * z_step;
+
+      p = low + i * p_step;
+      z = layer_altitude(layer_number, p);
+      inverse->value[i] = z;
+      inverse->slope[i] = p_step / pressure_slope(layer_number, z, p);
+   }
+
+   for(i = 0; i < TABLE_INTERVALS; ++i) {
+      double z = bottom + (i + 0.5) * z_step;
+      double exact = layer_pressure(layer_number, z);
+      if (!(fabs(hermite(forward, z) - exact) <= PRESSURE_TOLERANCE * exact))
+         ok = false;
+
+      double p = low + (i + 0.5) * p_step;
+      if (!(fabs(hermite(inverse, p) - layer_altitude(layer_number, p)) <= ALTITUDE_TOLERANCE))
+         ok = false;
+   }
+   return ok;
+}
+
+static void set_atmosphere(double ground_temperature, double ground_pressure)
+{
     int layer_number;
     double delta_z;
 
     base_temperature[0] = ground_temperature;
     base_pressure[0] = ground_pressure;
-    double base;
-    double exponent;
     /* calculate the base temperature and pressure for all atmospheric layers
      */
     for(layer_number = 0; layer_number < NUMBER_OF_LAYERS - 1; ++layer_number) {
       delta_z = base_altitude[layer_number + 1] - base_altitude[layer_number];
-      if (lapse_rate[layer_number] == 0.0) {
-         exponent = GRAVITATIONAL_ACCELERATION * delta_z
-              / AIR_GAS_CONSTANT / base_temperature[layer_number];
-         base_pressure[layer_number+1] = base_pressure[layer_number] * exp(exponent);
-      }
-      else {
-         base = (lapse_rate[layer_number] * delta_z / base_temperature[layer_number]) + 1.0;
-         exponent = GRAVITATIONAL_ACCELERATION /
-              (AIR_GAS_CONSTANT * lapse_rate[layer_number]);
-         base_pressure[layer_number+1] = base_pressure[layer_number] * pow(base, exponent);
-      }
+      base_pressure[layer_number+1] = layer_pressure(layer_number, base_altitude[layer_number + 1]);
       base_temperature[layer_number+1]= base_temperature[layer_number] + delta_z * lapse_rate[layer_number];
-   }   
+   }
+
+   tables_verified = true;
+   for(layer_number = 0; layer_number < NUMBER_OF_LAYERS; ++layer_number)
+      if (!build_tables(layer_number))
+         tables_verified = false;
+}
+
+static void init_default_atmosphere(void)
+{
+   set_atmosphere(LAYER0_BASE_TEMPERATURE, LAYER0_BASE_PRESSURE);
+}
+
+void init_atmosphere(double ground_temperature, double ground_pressure){
+    //TODO: accept altitude where measurements were taken, also humidity
+    pthread_once(&default_atmosphere, init_default_atmosphere);
+    set_atmosphere(ground_temperature, ground_pressure);
 }
 
 
@@ -76,110 +238,41 @@ double altitude_to_air_density(double altitude)
 
 
 double altitude_to_temperature(double altitude){
-    int layer_number, delta_z;
-
-    for(layer_number = 0; layer_number < NUMBER_OF_LAYERS - 1 && altitude > base_altitude[layer_number + 1]; ++layer_number)
-        /* empty */;
-
-    delta_z = altitude - base_altitude[layer_number];
-    return base_temperature[layer_number] + delta_z*lapse_rate[layer_number];
-
+    pthread_once(&default_atmosphere, init_default_atmosphere);
+    return layer_temperature(altitude_layer(altitude), altitude);
 }
 
 
 /* outputs atmospheric pressure associated with the given altitude. altitudes
    are geopotential measured with respect to the mean sea level */
 double altitude_to_pressure(double altitude) {
-
-   double pressure;
-   double base; /* base for function to determine pressure */
-   double exponent; /* exponent for function to determine pressure */
    int layer_number; /* identifies layer in the atmosphere */
-   int delta_z; /* difference between two altitudes */
-   
+
    if (altitude > MAXIMUM_ALTITUDE) /* FIX ME: use sensor data to improve model */
       return 0;
+   pthread_once(&default_atmosphere, init_default_atmosphere);
 
-   /*find correct layer_number*/
-   for(layer_number = 0; layer_number < NUMBER_OF_LAYERS - 1 && altitude > base_altitude[layer_number + 1]; ++layer_number)
-       /* empty */;
-
-   /* calculate the pressure at the inputted altitude */
-   delta_z = altitude - base_altitude[layer_number];
-   if (lapse_rate[layer_number] == 0.0) {
-      exponent = GRAVITATIONAL_ACCELERATION * delta_z 
-           / AIR_GAS_CONSTANT / base_temperature[layer_number];
-      pressure = base_pressure[layer_number] * exp(exponent);
-   }
-   else {
-      base = (lapse_rate[layer_number] * delta_z / base_temperature[layer_number]) + 1.0;
-      exponent = GRAVITATIONAL_ACCELERATION /
-           (AIR_GAS_CONSTANT * lapse_rate[layer_number]);
-      pressure = base_pressure[layer_number] * pow(base, exponent);
-   } 
-   return pressure;
+   layer_number = altitude_layer(altitude);
+   if (tables_verified && altitude >= LOWEST_ALTITUDE)
+      return hermite(&pressure_table[layer_number], altitude);
+   return layer_pressure(layer_number, altitude);
 }
 
 
 /* outputs the altitude associated with the given pressure. the altitude
    returned is measured with respect to the mean sea level */
 double pressure_to_altitude(double pressure) {
-   double next_base_temperature = LAYER0_BASE_TEMPERATURE;
-   double next_base_pressure = LAYER0_BASE_PRESSURE;
-
-   double altitude;
-   double base_pressure;
-   double base_temperature;
-   double base; /* base for function to determine base pressure of next layer */
-   double exponent; /* exponent for function to determine base pressure
-                             of next layer */
-   double coefficient;
    int layer_number; /* identifies layer in the atmosphere */
-   int delta_z; /* difference between two altitudes */
 
    if (pressure < 0)  /* illegal pressure */
       return -1;
    if (pressure < MINIMUM_PRESSURE) /* FIX ME: use sensor data to improve model */
       return MAXIMUM_ALTITUDE;
+   pthread_once(&default_atmosphere, init_default_atmosphere);
 
-   /* calculate the base temperature and pressure for the atmospheric layer
-      associated with the inputted pressure. */
-   layer_number = -1;
-   do {
-      layer_number++;
-      base_pressure = next_base_pressure;
-      base_temperature = next_base_temperature;
-      delta_z = base_altitude[layer_number + 1] - base_altitude[layer_number];
-      if (lapse_rate[layer_number] == 0.0) {
-         exponent = GRAVITATIONAL_ACCELERATION * delta_z 
-              / AIR_GAS_CONSTANT / base_temperature;
-         next_base_pressure *= exp(exponent);
-      }
-      else {
-         base = (lapse_rate[layer_number] * delta_z / base_temperature) + 1.0;
-         exponent = GRAVITATIONAL_ACCELERATION / 
-              (AIR_GAS_CONSTANT * lapse_rate[layer_number]);
-         next_base_pressure *= pow(base, exponent);
-      }
-      next_base_temperature += delta_z * lapse_rate[layer_number];
-   }
-   while(layer_number < NUMBER_OF_LAYERS - 1 && pressure < next_base_pressure);
-
-   /* calculate the altitude associated with the inputted pressure */
-   if (lapse_rate[layer_number] == 0.0) {
-      coefficient = (AIR_GAS_CONSTANT / GRAVITATIONAL_ACCELERATION) 
-                                                    * base_temperature;
-      altitude = base_altitude[layer_number]
-                    + coefficient * log(pressure / base_pressure);
-   }
-   else {
-      base = pressure / base_pressure;
-      exponent = AIR_GAS_CONSTANT * lapse_rate[layer_number] 
-                                       / GRAVITATIONAL_ACCELERATION;
-      coefficient = base_temperature / lapse_rate[layer_number];
-      altitude = base_altitude[layer_number]
-                      + coefficient * (pow(base, exponent) - 1);
-   }
-
-   return altitude;
+   layer_number = pressure_layer(pressure);
+   const struct hermite_table *table = &altitude_table[layer_number];
+   if (tables_verified && pressure >= table->start && pressure <= table->end)
+      return hermite(table, pressure);
+   return layer_altitude(layer_number, pressure);
 }
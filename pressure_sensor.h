@@ -19,7 +19,7 @@
 #define LAYER0_BASE_TEMPERATURE 288.15
 #define LAYER0_BASE_PRESSURE 101325
 #define MOLAR_MASS_DRY_AIR 0.0289644
-#define AIR_GAS_CONSTANT UNIVERSAL_GAS_CONSTANT/MOLAR_MASS_DRY_AIR
+#define AIR_GAS_CONSTANT (UNIVERSAL_GAS_CONSTANT/MOLAR_MASS_DRY_AIR)
 
 void init_atmosphere(double ground_temperature, double ground_pressure);
 double altitude_to_pressure(double) ATTR_WARN_UNUSED_RESULT;
@@ -0,0 +1,143 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#include "profile.h"
+
+#ifdef PROFILE
+
+#include <inttypes.h>
+#include <time.h>
+
+#define PROFILE_BUCKETS 64
+/* Must be a power of two */
+#define PROFILE_RING 4096
+
+static const char *const stage_names[PROFILE_STAGES] = {
+	[PROFILE_TICK] = "tick",
+	[PROFILE_WEIGH] = "weigh",
+	[PROFILE_STATE] = "state",
+	[PROFILE_RESAMPLE] = "resample",
+	[PROFILE_PROPAGATE] = "propagate",
+	[PROFILE_ACCELEROMETER] = "accelerometer",
+	[PROFILE_GYROSCOPE] = "gyroscope",
+	[PROFILE_PRESSURE] = "pressure",
+	[PROFILE_MAGNETOMETER] = "magnetometer",
+	[PROFILE_GPS] = "gps",
+};
+
+/* Bucket b counts durations in [2^b, 2^(b+1)) nanoseconds */
+static struct histogram {
+	uint64_t count, total, max;
+	uint64_t bucket[PROFILE_BUCKETS];
+} histograms[PROFILE_STAGES];
+
+struct profile_event {
+	uint64_t start;
+	uint32_t ns;
+	uint32_t stage;
+};
+
+/* The last PROFILE_RING events, oldest overwritten first, written and
+ * read only on the filter's thread; head counts every event ever
+ * recorded. */
+static struct profile_event ring[PROFILE_RING];
+static uint64_t head;
+
+static uint64_t deadline = 1000000;
+static uint64_t cycle_head, cycle_ns;
+static uint64_t cycles, overruns;
+static struct profile_event worst[PROFILE_RING];
+static unsigned worst_events;
+static uint64_t worst_ns;
+
+uint64_t profile_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void profile_set_deadline(uint64_t ns)
+{
+	deadline = ns;
+}
+
+static void end_cycle(uint64_t end)
+{
+	uint64_t i;
+	cycles++;
+	if(cycle_ns > deadline)
+		overruns++;
+	if(cycle_ns > worst_ns && end - cycle_head <= PROFILE_RING)
+	{
+		worst_ns = cycle_ns;
+		worst_events = 0;
+		for(i = cycle_head; i < end; ++i)
+			worst[worst_events++] = ring[i & (PROFILE_RING - 1)];
+	}
+	cycle_head = end;
+	cycle_ns = 0;
+}
+
+void profile_record(enum profile_stage stage, uint64_t start)
+{
+	uint64_t ns = profile_now() - start;
+	struct histogram *h = &histograms[stage];
+	int b = ns ? 63 - __builtin_clzll(ns) : 0;
+
+	h->count++;
+	h->total += ns;
+	if(ns > h->max)
+		h->max = ns;
+	h->bucket[b]++;
+
+	ring[head & (PROFILE_RING - 1)] = (struct profile_event) { start, ns, stage };
+	head++;
+
+	/* the tick's own stages are inside its time already */
+	if(stage == PROFILE_TICK || stage >= PROFILE_ACCELEROMETER)
+		cycle_ns += ns;
+	if(stage == PROFILE_TICK)
+		end_cycle(head);
+}
+
+/* Upper bound of the bucket holding the given fraction of the samples */
+static double quantile_us(const struct histogram *h, double q)
+{
+	uint64_t seen = 0;
+	int b;
+	for(b = 0; b < PROFILE_BUCKETS - 1; ++b)
+		if((seen += h->bucket[b]) >= q * h->count)
+			break;
+	double bound = 2.0 * ((uint64_t) 1 << b);
+	return (bound < h->max ? bound : h->max) / 1e3;
+}
+
+void profile_dump(FILE *out)
+{
+	unsigned i;
+	int stage;
+	fprintf(out, "%-14s %10s %10s %10s %10s %10s\n",
+	        "stage", "calls", "mean us", "p50 <= us", "p99 <= us", "max us");
+	for(stage = 0; stage < PROFILE_STAGES; ++stage)
+	{
+		const struct histogram *h = &histograms[stage];
+		if(!h->count)
+			continue;
+		fprintf(out, "%-14s %10" PRIu64 " %10.1f %10.1f %10.1f %10.1f\n",
+		        stage_names[stage], h->count, h->total / 1e3 / h->count,
+		        quantile_us(h, 0.5), quantile_us(h, 0.99), h->max / 1e3);
+	}
+	fprintf(out, "%" PRIu64 " of %" PRIu64 " cycles over the %.1f us deadline\n",
+	        overruns, cycles, deadline / 1e3);
+	if(!worst_events)
+		return;
+	fprintf(out, "worst cycle, %.1f us:\n", worst_ns / 1e3);
+	for(i = 0; i < worst_events; ++i)
+		fprintf(out, "  %-14s %10.1f us\n", stage_names[worst[i].stage], worst[i].ns / 1e3);
+}
+
+#endif /* PROFILE */
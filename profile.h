@@ -0,0 +1,50 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Per-stage timing of the filter, built in only when PROFILE is defined
+ * (make PROFILE=1); otherwise the macros below compile to nothing.  Every
+ * timed call lands in a log2 histogram for its stage and in a ring of recent
+ * events.  The calls made between the end of one tick and the end of the
+ * next make up a cycle, which has to fit in the deadline. */
+
+enum profile_stage {
+	PROFILE_TICK,
+	PROFILE_WEIGH,
+	PROFILE_STATE,
+	PROFILE_RESAMPLE,
+	PROFILE_PROPAGATE,
+	PROFILE_ACCELEROMETER,
+	PROFILE_GYROSCOPE,
+	PROFILE_PRESSURE,
+	PROFILE_MAGNETOMETER,
+	PROFILE_GPS,
+	PROFILE_STAGES
+};
+
+#ifdef PROFILE
+
+uint64_t profile_now(void);
+void profile_record(enum profile_stage stage, uint64_t start);
+void profile_set_deadline(uint64_t ns);
+void profile_dump(FILE *out);
+
+#define PROFILE_BEGIN(start) uint64_t start = profile_now()
+#define PROFILE_END(stage, start) profile_record(stage, start)
+
+#else
+
+#define PROFILE_BEGIN(start) do { } while(0)
+#define PROFILE_END(stage, start) do { } while(0)
+
+#endif
+
+#endif /* PROFILE_H */
@@ -0,0 +1,44 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#include <math.h>
+#include "quat.h"
+
+quat axis_angle_to_quat(vec3 axis_angle)
+{
+	double angle = vec_abs(axis_angle);
+	if(angle < 1e-30)
+		return (quat) { 1, 0, 0, 0 };
+	double s = sin(angle / 2) / angle;
+	return (quat) { cos(angle / 2), axis_angle.x * s, axis_angle.y * s, axis_angle.z * s };
+}
+
+/* http://www.euclideanspace.com/maths/geometry/rotations/conversions/matrixToQuaternion/
+ * taking the square root of whichever component is largest, so it is
+ * never taken of a difference near zero. */
+quat mat3_to_quat(mat3 m)
+{
+	const double (*r)[3] = m.component;
+	double trace = r[0][0] + r[1][1] + r[2][2];
+	double s;
+	if(trace > 0)
+	{
+		s = 2 * sqrt(1 + trace);
+		return (quat) { s / 4, (r[2][1] - r[1][2]) / s, (r[0][2] - r[2][0]) / s, (r[1][0] - r[0][1]) / s };
+	}
+	if(r[0][0] > r[1][1] && r[0][0] > r[2][2])
+	{
+		s = 2 * sqrt(1 + r[0][0] - r[1][1] - r[2][2]);
+		return (quat) { (r[2][1] - r[1][2]) / s, s / 4, (r[0][1] + r[1][0]) / s, (r[0][2] + r[2][0]) / s };
+	}
+	if(r[1][1] > r[2][2])
+	{
+		s = 2 * sqrt(1 + r[1][1] - r[0][0] - r[2][2]);
+		return (quat) { (r[0][2] - r[2][0]) / s, (r[0][1] + r[1][0]) / s, s / 4, (r[1][2] + r[2][1]) / s };
+	}
+	s = 2 * sqrt(1 + r[2][2] - r[0][0] - r[1][1]);
+	return (quat) { (r[1][0] - r[0][1]) / s, (r[0][2] + r[2][0]) / s, (r[1][2] + r[2][1]) / s, s / 4 };
+}
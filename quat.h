@@ -0,0 +1,62 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#ifndef QUAT_H
+#define QUAT_H
+
+#include "compiler.h"
+#include "mat.h"
+#include "vec.h"
+
+/* A rotation as a unit quaternion w + xi + yj + zk.  quat_to_mat3() gives
+ * the matrix of the same rotation, and quat_mul() composes rotations in the
+ * same order as mat3_mul(). */
+typedef struct quat {
+	double w, x, y, z;
+} quat;
+
+/* The exponential map: the rotation by vec_abs(axis_angle) radians about
+ * axis_angle, as axis_angle_to_mat3() */
+quat axis_angle_to_quat(vec3 axis_angle) ATTR_WARN_UNUSED_RESULT;
+/* m must be a rotation */
+quat mat3_to_quat(mat3 m) ATTR_WARN_UNUSED_RESULT;
+
+/* The rest are inline, as in vec.h */
+static inline quat quat_mul(quat left, quat right) ATTR_WARN_UNUSED_RESULT;
+/* Rounding leaves a product of unit quaternions only nearly unit; this
+ * scales it back. */
+static inline quat quat_normalize(quat q) ATTR_WARN_UNUSED_RESULT;
+static inline mat3 quat_to_mat3(quat q) ATTR_WARN_UNUSED_RESULT;
+
+static inline quat quat_mul(quat a, quat b)
+{
+	return (quat) {
+		a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+		a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+		a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+		a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+	};
+}
+
+static inline quat quat_normalize(quat q)
+{
+	double scale = 1 / sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+	return (quat) { q.w * scale, q.x * scale, q.y * scale, q.z * scale };
+}
+
+static inline mat3 quat_to_mat3(quat q)
+{
+	double xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	double xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	double wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+	return (mat3) {{
+		1 - 2 * (yy + zz), 2 * (xy - wz), 2 * (xz + wy),
+		2 * (xy + wz), 1 - 2 * (xx + zz), 2 * (yz - wx),
+		2 * (xz - wy), 2 * (yz + wx), 1 - 2 * (xx + yy),
+	}};
+}
+
+#endif /* QUAT_H */
@@ -4,48 +4,264 @@
  * This program is licensed under the GPL version 2 or later.  Please see the
  * file COPYING in the source distribution of this software for license terms.
  */
+#include <math.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "noise.h"
 #include "particle.h"
 #include "resample.h"
-#include "ziggurat/zrandom.h"
 
-void resample_regular(int m, struct particle *particle,
-                      int n, struct particle *newp,
-                      int sort)
+/* Grows a scratch buffer owned by the caller to hold at least size elements */
+static void *scratch(void *buffer, unsigned *capacity, unsigned size, size_t element)
 {
-	int i, j;
-	double u0, t = 0;
-	if (sort)
+	if (size <= *capacity)
+		return buffer;
+	free(buffer);
+	buffer = malloc(size * element);
+	if (!buffer)
 	{
-		/* shuffle */
-		for (i = 0; i < m - 1; i++)
-		{
-			j = rand32() % (m - i) + i;
-			struct particle ptmp = particle[j];
-			particle[j] = particle[i];
-			particle[i] = ptmp;
-		}
+		fprintf(stderr, "cannot allocate %u resampling entries\n", size);
+		abort();
+	}
+	*capacity = size;
+	return buffer;
+}
+
+/* n uniforms from s, in a buffer reused from call to call */
+static const double *uniforms(struct noise_stream *s, unsigned n)
+{
+	static double *u;
+	static unsigned u_size;
+	u = scratch(u, &u_size, n, sizeof(*u));
+	noise_uniform(s, u, n);
+	return u;
+}
+
+/* Index of the last particle with any weight.  Walks that run past the end
+ * of the cumulative weights through rounding error stop here instead. */
+static unsigned last_weighted(const double *weight, unsigned m)
+{
+	unsigned last = m - 1;
+	while (last > 0 && !(weight[last] > 0))
+		last--;
+	return last;
+}
+
+/* One uniform offset shared by n evenly spaced pointers */
+static void resample_systematic(const double *weight, double total, unsigned m,
+                                unsigned *ancestor, unsigned n,
+                                struct noise_stream *noise)
+{
+	unsigned last = last_weighted(weight, m);
+	double step = total / n;
+	double u = *uniforms(noise, 1) * step;
+	double cumulative = weight[0];
+	unsigned i, j = 0;
+	for (i = 0; i < n; i++)
+	{
+		while (cumulative <= u && j < last)
+			cumulative += weight[++j];
+		ancestor[i] = j;
+		u += step;
+	}
+}
+
+/* A fresh uniform offset within each of n equal strata */
+static void resample_stratified(const double *weight, double total, unsigned m,
+                                unsigned *ancestor, unsigned n,
+                                struct noise_stream *noise)
+{
+	unsigned last = last_weighted(weight, m);
+	double step = total / n;
+	const double *offset = uniforms(noise, n);
+	double cumulative = weight[0];
+	unsigned i, j = 0;
+	for (i = 0; i < n; i++)
+	{
+		double u = (i + offset[i]) * step;
+		while (cumulative <= u && j < last)
+			cumulative += weight[++j];
+		ancestor[i] = j;
+	}
+}
+
+/* Copies floor(n w / total) of each particle outright, then fills the
+ * remaining slots systematically from the fractional parts. */
+static void resample_residual(const double *weight, double total, unsigned m,
+                              unsigned *ancestor, unsigned n,
+                              struct noise_stream *noise)
+{
+	double scale = n / total;
+	unsigned i = 0, j;
+	for (j = 0; j < m; j++)
+	{
+		unsigned copies = weight[j] * scale;
+		while (copies-- && i < n)
+			ancestor[i++] = j;
 	}
-	/* merge */
+	if (i == n)
+		return;
+
+	double residual_total = 0;
+	for (j = 0; j < m; j++)
+	{
+		double expected = weight[j] * scale;
+		residual_total += expected - floor(expected);
+	}
+	unsigned last = last_weighted(weight, m);
+	if (!(residual_total > 0))
+	{
+		/* only rounding error can leave slots with no residual
+		   weight to fill them; there are at most a few */
+		while (i < n)
+			ancestor[i++] = last;
+		return;
+	}
+
+	unsigned remaining = n - i;
+	double step = residual_total / remaining;
+	double u = *uniforms(noise, 1) * step;
+	double expected = weight[0] * scale;
+	double cumulative = expected - floor(expected);
 	j = 0;
-	u0 = uniform() * 1.0 / (n + 1);
-	for (i = 0; i < n; i++ )
+	for (; i < n; i++)
 	{
-		for (;j < m; j++)
+		while (cumulative <= u && j < last)
 		{
-			double w = exp(particle[j].weight);
-			if (t + w >= u0)
-				break;
-			t += w;
+			expected = weight[++j] * scale;
+			cumulative += expected - floor(expected);
 		}
+		ancestor[i] = j;
+		u += step;
+	}
+}
+
+/* Independent draws, each O(1) from Vose's alias table */
+static void resample_multinomial(const double *weight, double total, unsigned m,
+                                 unsigned *ancestor, unsigned n,
+                                 struct noise_stream *noise)
+{
+	static double *probability;
+	static unsigned *alias, *worklist;
+	static unsigned probability_size, alias_size, worklist_size;
+	unsigned small = 0, large = m;
+	unsigned i, j;
+
+	probability = scratch(probability, &probability_size, m, sizeof(*probability));
+	alias = scratch(alias, &alias_size, m, sizeof(*alias));
+	worklist = scratch(worklist, &worklist_size, m, sizeof(*worklist));
+
+	/* the small stack grows up from the front of worklist and the large
+	   one down from the back; together they never hold more than m */
+	for (j = 0; j < m; j++)
+	{
+		probability[j] = weight[j] * m / total;
+		if (probability[j] < 1)
+			worklist[small++] = j;
+		else
+			worklist[--large] = j;
+	}
+	while (small > 0 && large < m)
+	{
+		unsigned less = worklist[--small], more = worklist[large++];
+		alias[less] = more;
+		probability[more] -= 1 - probability[less];
+		if (probability[more] < 1)
+			worklist[small++] = more;
+		else
+			worklist[--large] = more;
+	}
+	/* whatever is left over is full up to rounding error */
+	while (small > 0)
+		probability[worklist[--small]] = 1;
+	while (large < m)
+		probability[worklist[large++]] = 1;
+
+	const double *draw = uniforms(noise, n);
+	for (i = 0; i < n; i++)
+	{
+		double u = draw[i] * m;
+		j = u;
 		if (j >= m)
+			j = m - 1;
+		ancestor[i] = u - j < probability[j] ? j : alias[j];
+	}
+}
+
+void resample(enum resampler method, const double *weight, double total,
+              unsigned m, unsigned *ancestor, unsigned n,
+              struct noise_stream *noise)
+{
+	switch (method)
+	{
+	case RESAMPLE_SYSTEMATIC:
+		resample_systematic(weight, total, m, ancestor, n, noise);
+		break;
+	case RESAMPLE_STRATIFIED:
+		resample_stratified(weight, total, m, ancestor, n, noise);
+		break;
+	case RESAMPLE_RESIDUAL:
+		resample_residual(weight, total, m, ancestor, n, noise);
+		break;
+	case RESAMPLE_MULTINOMIAL:
+		resample_multinomial(weight, total, m, ancestor, n, noise);
+		break;
+	}
+}
+
+unsigned kld_sample_size(unsigned k, double epsilon, double z)
+{
+	if (k < 2)
+		return 1;
+	double a = 2.0 / (9.0 * (k - 1));
+	double b = 1.0 - a + sqrt(a) * z;
+	return ceil((k - 1) / (2.0 * epsilon) * b * b * b);
+}
+
+static uint64_t mix(uint64_t h, double v, double bin)
+{
+	h ^= (uint64_t) (int64_t) floor(v / bin);
+	h *= UINT64_C(0x9E3779B97F4A7C15);
+	return h ^ (h >> 29);
+}
+
+unsigned count_occupied_bins(const struct particle_store *particle,
+                             double pos_bin, double vel_bin,
+                             double min_weight)
+{
+	/* open-addressed set of bin hashes; 0 marks an empty slot */
+	static uint64_t *table;
+	static unsigned table_size;
+	unsigned size = 1, i, bins = 0;
+
+	while (size < 2 * particle->count)
+		size <<= 1;
+	table = scratch(table, &table_size, size, sizeof(*table));
+	memset(table, 0, size * sizeof(*table));
+
+	for (i = 0; i < particle->count; i++)
+	{
+		if (particle->weight[i] < min_weight)
+			continue;
+		uint64_t h = 0;
+		h = mix(h, particle->pos.x[i], pos_bin);
+		h = mix(h, particle->pos.y[i], pos_bin);
+		h = mix(h, particle->pos.z[i], pos_bin);
+		h = mix(h, particle->vel.x[i], vel_bin);
+		h = mix(h, particle->vel.y[i], vel_bin);
+		h = mix(h, particle->vel.z[i], vel_bin);
+		h |= 1;
+		unsigned slot = h & (size - 1);
+		while (table[slot] && table[slot] != h)
+			slot = (slot + 1) & (size - 1);
+		if (!table[slot])
 		{
-			fprintf(stderr, "fell off end t=%.14g u0=%.14g\n", t, u0);
-			abort();
+			table[slot] = h;
+			bins++;
 		}
-		newp[i] = particle[j];
-		newp[i].weight = -log(n);
-		u0 += 1.0 / (n + 1);
 	}
+	return bins;
 }
@@ -7,11 +7,37 @@
 #ifndef _RESAMPLE_H
 #define _RESAMPLE_H
 
+#include "noise.h"
 #include "particle.h"
 
-/* returns a pointer to the highest-weighted particle */
-void resample_regular(int m, struct particle *particle,
-                      int n, struct particle *newp,
-                      int sort);
+enum resampler {
+	RESAMPLE_SYSTEMATIC,
+	RESAMPLE_STRATIFIED,
+	RESAMPLE_RESIDUAL,
+	RESAMPLE_MULTINOMIAL,
+};
+
+/* Draws n particles out of m in proportion to weight, their linear weights,
+ * which add up to total, and stores the index each new particle is copied
+ * from in ancestor.  Each method makes a single ordered pass over the
+ * weights (multinomial builds an alias table first); the caller moves the
+ * particles, e.g. with particle_gather().  The random offsets come from
+ * noise. */
+void resample(enum resampler method, const double *weight, double total,
+              unsigned m, unsigned *ancestor, unsigned n,
+              struct noise_stream *noise);
+
+/* KLD-sampling, from Fox, "Adapting the Sample Size in Particle Filters
+ * Through KLD-Sampling" (2003): the number of particles needed so that, with
+ * the confidence given by the standard normal quantile z, the KL divergence
+ * between the particle set and a posterior spread over k histogram bins
+ * stays under epsilon. */
+unsigned kld_sample_size(unsigned k, double epsilon, double z);
+
+/* Counts the bins of a position/velocity histogram occupied by particles
+ * whose log weight is at least min_weight. */
+unsigned count_occupied_bins(const struct particle_store *particle,
+                             double pos_bin, double vel_bin,
+                             double min_weight);
 
 #endif
@@ -14,15 +14,13 @@
 #include "vec.h"
 #include "spherical_harmonics.h"
 
-#define G 9.80665
-
 /* TODO: move sensor bias/gain to rocket_state so BPF can estimate them */
 
-accelerometer_d accelerometer_measurement(struct rocket_state *state)
+accelerometer_d accelerometer_measurement(const struct gravity_field *gravity, struct rocket_state *state)
 {
-	const accelerometer_d bias = { 2400.45  , 2462.06  , 1918.72  , 1907.53   };
-	const accelerometer_d gain = {  392.80/G,  386.90/G,   77.00/G,   75.40/G };
-	vec3 ecef = vec_sub(state->acc, gravity_acceleration(state));
+	const accelerometer_d bias = ACCELEROMETER_BIAS;
+	const accelerometer_d gain = ACCELEROMETER_GAIN;
+	vec3 ecef = vec_sub(state->acc, gravity_acceleration(gravity, state->pos));
 	vec3 rocket = ECEF_to_rocket(state, ecef);
 	return (accelerometer_d) {
 		.x = rocket.x * gain.x + bias.x,
@@ -34,8 +32,8 @@ accelerometer_d accelerometer_measurement(struct rocket_state *state)
 
 vec3 gyroscope_measurement(struct rocket_state *state)
 {
-	const vec3 bias = { 2048, 2048, 2048 };
-	const vec3 gain = { 5 * 1.1628 * 180 / M_PI, 5 * 1.1628 * 180 / M_PI, 5 * 1.1628 * 180 / M_PI };
+	const vec3 bias = GYROSCOPE_BIAS;
+	const vec3 gain = GYROSCOPE_GAIN;
 	vec3 rocket = ECEF_to_rocket(state, state->rotvel);
 	return (vec3) {
 		.x = rocket.x * gain.x + bias.x,
@@ -45,17 +43,22 @@ vec3 gyroscope_measurement(struct rocket_state *state)
 }
 
 double pressure_measurement(struct rocket_state *state)
+{
+	return pressure_measurement_at(ECEF_to_geodetic(state->pos).altitude);
+}
+
+double pressure_measurement_at(double altitude)
 {
 	const double bias = -470.734;
 	const double gain = 44.549779924087175 / 1000;
-	double rocket = altitude_to_pressure(ECEF_to_geodetic(state->pos).altitude);
+	double rocket = altitude_to_pressure(altitude);
 	return rocket * gain + bias;
 }
 
 vec3 magnetometer_measurement(struct rocket_state *state)
 {
-	const vec3 bias = { 0, 0, 0 };
-	const vec3 gain = { 1, 1, 1 };
+	const vec3 bias = MAGNETOMETER_BIAS;
+	const vec3 gain = MAGNETOMETER_GAIN;
         vec3 mag = magnetic_field(ECEF_to_geodetic(state->pos));
 	vec3 mag_sensor = rocket_to_ECEF(state, mag);
 	return (vec3) {
@@ -8,15 +8,31 @@
 #define SENSORS_H
 
 #include "compiler.h"
+#include "gravity.h"
 #include "physics.h"
 
 typedef struct accelerometer_d {
 	double x, y, z, q;
 } accelerometer_d;
 
-accelerometer_d accelerometer_measurement(struct rocket_state *state) ATTR_WARN_UNUSED_RESULT;
+/* Sensor calibration, shared by the measurement models below and the
+ * batched likelihood kernels. */
+static const accelerometer_d ACCELEROMETER_BIAS = { 2400.45, 2462.06, 1918.72, 1907.53 };
+static const accelerometer_d ACCELEROMETER_GAIN = {
+	392.80 / 9.80665, 386.90 / 9.80665, 77.00 / 9.80665, 75.40 / 9.80665
+};
+static const vec3 GYROSCOPE_BIAS = { 2048, 2048, 2048 };
+static const vec3 GYROSCOPE_GAIN = {
+	5 * 1.1628 * 180 / M_PI, 5 * 1.1628 * 180 / M_PI, 5 * 1.1628 * 180 / M_PI
+};
+static const vec3 MAGNETOMETER_BIAS = { 0, 0, 0 };
+static const vec3 MAGNETOMETER_GAIN = { 1, 1, 1 };
+
+accelerometer_d accelerometer_measurement(const struct gravity_field *gravity, struct rocket_state *state) ATTR_WARN_UNUSED_RESULT;
 vec3 gyroscope_measurement(struct rocket_state *state);
 double pressure_measurement(struct rocket_state *state) ATTR_WARN_UNUSED_RESULT;
+/* The same, for a rocket whose altitude is already known */
+double pressure_measurement_at(double altitude) ATTR_WARN_UNUSED_RESULT;
 vec3 magnetometer_measurement(struct rocket_state *state);
 
 #endif /* SENSORS_H */
@@ -5,18 +5,140 @@
  * file COPYING in the source distribution of this software for license terms.
  */
 #include <stdarg.h>
+#include <inttypes.h>
+#include <math.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "compiler.h"
 #include "coord.h"
 #include "interface.h"
+#include "profile.h"
 #include "sim-common.h"
 
 static bool trace, trace_physics, trace_ltp;
+/* FNV-1a hash of every state the filter reports, for checking that two
+ * runs agree bit for bit */
+static bool deterministic;
+static uint64_t digest = UINT64_C(0xcbf29ce484222325);
 static enum state fc_state;
 geodetic initial_geodetic;
+struct filter_options filter_options = FILTER_OPTIONS_DEFAULT;
+enum gravity_model sim_gravity;
+enum integrator sim_integrator = INTEGRATE_RK45;
+double sim_tolerance = 1e-3;
+
+/* --checkpoint-every=SECONDS saves a checkpoint at each multiple of that
+ * many seconds, to files named from --checkpoint-prefix and the time;
+ * --resume=FILE starts from one */
+static double checkpoint_interval, next_checkpoint;
+static const char *checkpoint_prefix = "checkpoint";
+static const char *resume_file;
+
+/* What a checkpoint file starts with; the filter's checkpoint and then the
+ * driver's own state follow. */
+#define CHECKPOINT_FILE_MAGIC "PSASSIMC"
+struct checkpoint_file_header {
+	char magic[8];
+	uint64_t filter_size, driver_size;
+	uint64_t digest;
+	double time;
+	uint32_t fc_state;
+	uint32_t reserved;
+};
+
+static enum resampler parse_resampler(const char *name)
+{
+	static const char *const names[] = {
+		[RESAMPLE_SYSTEMATIC] = "systematic",
+		[RESAMPLE_STRATIFIED] = "stratified",
+		[RESAMPLE_RESIDUAL] = "residual",
+		[RESAMPLE_MULTINOMIAL] = "multinomial",
+	};
+	unsigned i;
+	for(i = 0; i < sizeof(names) / sizeof(*names); i++)
+		if(!strcmp(name, names[i]))
+			return i;
+	fprintf(stderr, "unknown resampler '%s'\n", name);
+	exit(EXIT_FAILURE);
+}
+
+static enum gravity_model parse_gravity(const char *name)
+{
+	static const char *const names[] = {
+		[GRAVITY_POINT_MASS] = "point",
+		[GRAVITY_EGM] = "egm",
+	};
+	unsigned i;
+	for(i = 0; i < sizeof(names) / sizeof(*names); i++)
+		if(!strcmp(name, names[i]))
+			return i;
+	fprintf(stderr, "unknown gravity model '%s'\n", name);
+	exit(EXIT_FAILURE);
+}
+
+static enum integrator parse_integrator(const char *name)
+{
+	static const char *const names[] = {
+		[INTEGRATE_EULER] = "euler",
+		[INTEGRATE_LEAPFROG] = "leapfrog",
+		[INTEGRATE_RK4] = "rk4",
+		[INTEGRATE_RK45] = "rk45",
+	};
+	unsigned i;
+	for(i = 0; i < sizeof(names) / sizeof(*names); i++)
+		if(!strcmp(name, names[i]))
+			return i;
+	fprintf(stderr, "unknown integrator '%s'\n", name);
+	exit(EXIT_FAILURE);
+}
+
+static void hash_vec(vec3 v)
+{
+	const unsigned char *p = (const unsigned char *) &v;
+	size_t i;
+	for(i = 0; i < sizeof(v); i++)
+	{
+		digest ^= p[i];
+		digest *= UINT64_C(0x100000001b3);
+	}
+}
+
+/* --profile dumps the filter's stage timings at exit, and SIGUSR1 asks
+ * for a dump at the next poll_profile() */
+static volatile sig_atomic_t profile_requested;
+
+static void request_profile(int signum)
+{
+	(void) signum;
+	profile_requested = 1;
+}
+
+#ifdef PROFILE
+static void dump_profile(void)
+{
+	profile_dump(stderr);
+}
+#endif
+
+void poll_profile(void)
+{
+#ifdef PROFILE
+	if(profile_requested)
+	{
+		profile_requested = 0;
+		profile_dump(stderr);
+	}
+#endif
+}
+
+static void print_digest(void)
+{
+	printf("filter digest %016" PRIx64 "\n", digest);
+}
 
 void parse_trace_args(int argc, const char *const argv[])
 {
@@ -29,7 +151,143 @@ void parse_trace_args(int argc, const char *const argv[])
 			trace = trace_physics = true;
 		else if(!strcmp(argv[i], "--trace-ltp"))
 			trace_ltp = true;
+		else if(!strncmp(argv[i], "--threads=", 10))
+			filter_options.threads = strtoul(argv[i] + 10, NULL, 0);
+		else if(!strncmp(argv[i], "--particles=", 12))
+			filter_options.particles = strtoul(argv[i] + 12, NULL, 0);
+		else if(!strcmp(argv[i], "--adaptive"))
+			filter_options.adaptive = true;
+		else if(!strncmp(argv[i], "--min-particles=", 16))
+			filter_options.min_particles = strtoul(argv[i] + 16, NULL, 0);
+		else if(!strncmp(argv[i], "--max-particles=", 16))
+			filter_options.max_particles = strtoul(argv[i] + 16, NULL, 0);
+		else if(!strncmp(argv[i], "--resampler=", 12))
+			filter_options.resampler = parse_resampler(argv[i] + 12);
+		else if(!strncmp(argv[i], "--genealogy=", 12))
+			filter_options.genealogy = strtoul(argv[i] + 12, NULL, 0);
+		else if(!strncmp(argv[i], "--ltp-radius=", 13))
+			filter_options.ltp_radius = strtod(argv[i] + 13, NULL);
+		else if(!strncmp(argv[i], "--gravity=", 10))
+			filter_options.gravity = sim_gravity = parse_gravity(argv[i] + 10);
+		else if(!strncmp(argv[i], "--sim-gravity=", 14))
+			sim_gravity = parse_gravity(argv[i] + 14);
+		else if(!strncmp(argv[i], "--gravity-degree=", 17))
+			filter_options.gravity_degree = strtoul(argv[i] + 17, NULL, 0);
+		else if(!strncmp(argv[i], "--integrator=", 13))
+			filter_options.integrator = parse_integrator(argv[i] + 13);
+		else if(!strncmp(argv[i], "--sim-integrator=", 17))
+			sim_integrator = parse_integrator(argv[i] + 17);
+		else if(!strncmp(argv[i], "--sim-tolerance=", 16))
+			sim_tolerance = strtod(argv[i] + 16, NULL);
+		else if(!strncmp(argv[i], "--seed=", 7))
+			filter_options.seed = strtoull(argv[i] + 7, NULL, 0);
+		else if(!strncmp(argv[i], "--checkpoint-every=", 19))
+			next_checkpoint = checkpoint_interval = strtod(argv[i] + 19, NULL);
+		else if(!strncmp(argv[i], "--checkpoint-prefix=", 20))
+			checkpoint_prefix = argv[i] + 20;
+		else if(!strncmp(argv[i], "--resume=", 9))
+			resume_file = argv[i] + 9;
+		else if(!strcmp(argv[i], "--deterministic"))
+			deterministic = true;
+		else if(!strcmp(argv[i], "--profile"))
+		{
+#ifdef PROFILE
+			atexit(dump_profile);
+#else
+			fprintf(stderr, "--profile needs a build with PROFILE=1\n");
+#endif
+		}
+#ifdef PROFILE
+		else if(!strncmp(argv[i], "--deadline-us=", 14))
+			profile_set_deadline(strtoull(argv[i] + 14, NULL, 0) * 1000);
+#endif
 	}
+	signal(SIGUSR1, request_profile);
+	if(deterministic)
+		atexit(print_digest);
+}
+
+bool checkpoint_due(void)
+{
+	double now = current_timestamp();
+	if(checkpoint_interval <= 0 || now < next_checkpoint)
+		return false;
+	next_checkpoint = (floor(now / checkpoint_interval) + 1) * checkpoint_interval;
+	return true;
+}
+
+void write_checkpoint(const void *driver, size_t driver_size)
+{
+	struct checkpoint_file_header header = {
+		.magic = CHECKPOINT_FILE_MAGIC,
+		.filter_size = checkpoint_size(),
+		.driver_size = driver_size,
+		.digest = digest,
+		.time = current_timestamp(),
+		.fc_state = fc_state,
+	};
+	char name[4096];
+	void *blob;
+	FILE *f;
+
+	if(!(blob = malloc(header.filter_size)))
+	{
+		fprintf(stderr, "cannot allocate a %lu-byte checkpoint\n", (unsigned long) header.filter_size);
+		abort();
+	}
+	save_checkpoint(blob);
+	snprintf(name, sizeof(name), "%s-%09.3f.ckpt", checkpoint_prefix, current_timestamp());
+	if(!(f = fopen(name, "wb")) ||
+	   fwrite(&header, sizeof(header), 1, f) != 1 ||
+	   fwrite(blob, header.filter_size, 1, f) != 1 ||
+	   (driver_size && fwrite(driver, driver_size, 1, f) != 1) ||
+	   fclose(f))
+	{
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	free(blob);
+	trace_printf("Saved checkpoint %s\n", name);
+}
+
+static void bad_checkpoint(void)
+{
+	fprintf(stderr, "%s: not a checkpoint this program wrote\n", resume_file);
+	exit(EXIT_FAILURE);
+}
+
+bool resume_checkpoint(void *driver, size_t driver_size)
+{
+	struct checkpoint_file_header header;
+	void *blob = NULL;
+	FILE *f;
+
+	if(!resume_file)
+		return false;
+	if(!(f = fopen(resume_file, "rb")))
+	{
+		perror(resume_file);
+		exit(EXIT_FAILURE);
+	}
+	if(fread(&header, sizeof(header), 1, f) != 1 ||
+	   memcmp(header.magic, CHECKPOINT_FILE_MAGIC, sizeof(header.magic)) ||
+	   header.driver_size != driver_size || header.filter_size > SIZE_MAX ||
+	   !(blob = malloc(header.filter_size)) ||
+	   fread(blob, header.filter_size, 1, f) != 1 ||
+	   (driver_size && fread(driver, driver_size, 1, f) != 1) ||
+	   getc(f) != EOF)
+		bad_checkpoint();
+	/* Quietly, so resuming doesn't trace a state change that happened
+	 * before the checkpoint */
+	fc_state = header.fc_state;
+	if(!restore_checkpoint(blob, header.filter_size))
+		bad_checkpoint();
+	fclose(f);
+	free(blob);
+	digest = header.digest;
+	if(checkpoint_interval > 0)
+		next_checkpoint = (floor(header.time / checkpoint_interval) + 1) * checkpoint_interval;
+	return true;
 }
 
 void trace_printf(const char *fmt, ...)
@@ -47,6 +305,14 @@ void trace_printf(const char *fmt, ...)
 void trace_state(const char *source, struct rocket_state *state, const char *fmt, ...)
 {
 	va_list args;
+	if(deterministic && !strcmp(source, "bpf"))
+	{
+		hash_vec(state->pos);
+		hash_vec(state->vel);
+		hash_vec(state->acc);
+		hash_vec(state->rotvel);
+	}
+
 	if(trace_physics)
 	{
 		va_start(args, fmt);
@@ -8,10 +8,30 @@
 #define SIM_COMMON_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "compiler.h"
 
 extern geodetic initial_geodetic;
+extern struct filter_options filter_options;
+/* The gravity a simulated rocket falls under: --gravity sets it along with
+ * the filter's, --sim-gravity alone */
+extern enum gravity_model sim_gravity;
+/* How the simulator moves the rocket, and for INTEGRATE_RK45 the error
+ * allowed per step in meters and meters/second */
+extern enum integrator sim_integrator;
+extern double sim_tolerance;
 void parse_trace_args(int argc, const char *const argv[]);
+/* Checkpoints for --checkpoint-every and --resume.  Drivers ask
+ * checkpoint_due() once a tick and, when it says so, hand
+ * write_checkpoint() whatever of their own state they need to carry on from
+ * there.  resume_checkpoint() restores the filter in place of init() and
+ * fills in the driver's state, or returns false without --resume. */
+bool checkpoint_due(void);
+void write_checkpoint(const void *driver, size_t driver_size);
+bool resume_checkpoint(void *driver, size_t driver_size);
+/* Drivers call this regularly so a profile dump requested by signal can
+ * happen outside the signal handler. */
+void poll_profile(void);
 
 enum state last_reported_state(void);
 void trace_printf(const char *fmt, ...) ATTR_FORMAT(printf,1,2);
@@ -11,12 +11,13 @@
 #include <string.h>
 #include "coord.h"
 #include "vec.h"
+#include "integrate.h"
 #include "interface.h"
+#include "noise.h"
 #include "physics.h"
 #include "pressure_sensor.h"
 #include "sensors.h"
 #include "sim-common.h"
-#include "ziggurat/zrandom.h"
 
 static const microseconds DELTA_T = 1000;
 #define DELTA_T_SECONDS (DELTA_T / 1000000.0)
@@ -39,8 +40,10 @@ static const double ROCKET_DRAG_COEFFICIENT = 0.36559;
 static const double ROCKET_CROSS_SECTION = 0.015327901242699;
 static const double AIR_DENSITY = 1.225;
 
+/* The adaptive integrator's longest step */
+static const double MAX_STEP = 0.5;
+
 static microseconds t;
-static double mass;
 static bool engine_ignited;
 static microseconds engine_ignition_time;
 static bool engine_burning;
@@ -49,6 +52,11 @@ static bool main_chute_deployed;
 
 /* State of the simulated rocket. */
 static struct rocket_state rocket_state;
+static struct gravity_field gravity;
+static struct adaptive_integrator integrator;
+/* Set when something the rates depend on changes, so the adaptive
+ * integrator starts over from there rather than interpolating across it */
+static bool rates_changed;
 
 double current_timestamp(void)
 {
@@ -67,6 +75,7 @@ void ignite(bool go)
 			engine_ignited = true;
 			engine_burning = true;
 			engine_ignition_time = t;
+			rates_changed = true;
 		}
 		else
 			trace_printf("Rocket trying to reignite engine.\n");
@@ -81,6 +90,7 @@ void drogue_chute(bool go)
 		{
 			trace_printf("Drogue chute deployed\n");
 			drogue_chute_deployed = true;
+			rates_changed = true;
 		}
 		else
 			trace_printf("Rocket trying to redeploy drogue chute.\n");
@@ -95,6 +105,7 @@ void main_chute(bool go)
 		{
 			trace_printf("Main chute deployed\n");
 			main_chute_deployed = true;
+			rates_changed = true;
 		}
 		else
 			trace_printf("Rocket trying to redeploy main chute.\n");
@@ -136,33 +147,58 @@ static vec3 drag_force(const struct rocket_state *rocket_state)
 	                 * cross_section * drag_coefficient);
 }
 
-static vec3 thrust_force(const struct rocket_state *rocket_state, microseconds time)
+/* Seconds the engine has been burning at the given time in seconds, up to
+ * its burn time */
+static double burn_time(double time)
+{
+	if(!engine_ignited)
+		return 0;
+	double burning = time - engine_ignition_time / 1e6;
+	return fmin(fmax(burning, 0), ENGINE_BURN_TIME / 1e6);
+}
+
+static double rocket_mass(double time)
+{
+	return ROCKET_EMPTY_MASS + FUEL_MASS * (1 - burn_time(time) / (ENGINE_BURN_TIME / 1e6));
+}
+
+static vec3 thrust_force(const struct rocket_state *rocket_state, double time)
 {
 	if(!engine_burning)
 	        return (vec3) { 0, 0, 0 };
-	const microseconds ENGINE_RAMP_TIME = 200000;
+	const double ENGINE_RAMP_TIME = 0.2;
+	double burning = burn_time(time);
 	double scale = 1.0;
-	if(time - engine_ignition_time < ENGINE_RAMP_TIME)
-		scale = (double) (time - engine_ignition_time) / ENGINE_RAMP_TIME;
-	else if(time - engine_ignition_time > ENGINE_BURN_TIME - ENGINE_RAMP_TIME)
-		scale = (double) (engine_ignition_time + ENGINE_BURN_TIME - time) / ENGINE_RAMP_TIME;
+	if(burning < ENGINE_RAMP_TIME)
+		scale = burning / ENGINE_RAMP_TIME;
+	else if(burning > ENGINE_BURN_TIME / 1e6 - ENGINE_RAMP_TIME)
+		scale = (ENGINE_BURN_TIME / 1e6 - burning) / ENGINE_RAMP_TIME;
 	return rocket_to_ECEF(rocket_state, (vec3) { 0, 0, scale * ENGINE_THRUST });
 }
 
+/* time is in seconds */
 static vec3 expected_acceleration(double time, const struct rocket_state *rocket_state)
 {
 	/* TODO: add coefficient of normal force at the center of pressure */
-	vec3 force = vec_add(thrust_force(rocket_state, (microseconds) time), drag_force(rocket_state));
-	vec3 accel = vec_add(gravity_acceleration(rocket_state), vec_scale(force, 1/mass));
+	vec3 force = vec_add(thrust_force(rocket_state, time), drag_force(rocket_state));
+	vec3 accel = vec_axpy(1/rocket_mass(time), force, gravity_acceleration(&gravity, rocket_state->pos));
 
+	/* Within a millimeter counts as resting on the ground, so rounding
+	 * in the conversions can't drop a landed rocket into free fall. */
 	geodetic pos = ECEF_to_geodetic(rocket_state->pos);
-	if(pos.altitude <= initial_geodetic.altitude){
+	if(pos.altitude <= initial_geodetic.altitude + 1e-3){
 		mat3 rot = make_LTP_rotation(pos);
 		ground_clip(&accel, rot);
 	}
 	return accel;
 }
 
+/* Nothing turns the rocket yet */
+static struct rocket_rates rocket_rates(double time, const struct rocket_state *rocket_state)
+{
+	return (struct rocket_rates) { expected_acceleration(time, rocket_state), { 0, 0, 0 } };
+}
+
 static unsigned quantize(double value, unsigned mask)
 {
 	long int rounded = lround(value);
@@ -192,38 +228,54 @@ static vec3_i quantize_vec(vec3 value, unsigned mask)
 	};
 }
 
+/* The simulated sensors draw from a stream of their own, well clear of the
+ * ones the filter numbers up from zero. */
+static struct noise_stream sensor_noise_stream;
+static double sensor_noise_buffer[64];
+static unsigned sensor_noise_left;
+
+static double sensor_noise(double sd)
+{
+	if(!sensor_noise_left)
+	{
+		noise_gaussian(&sensor_noise_stream, sensor_noise_buffer, 64, 1.0);
+		sensor_noise_left = 64;
+	}
+	return sd * sensor_noise_buffer[--sensor_noise_left];
+}
+
 static accelerometer_d add_accelerometer_noise(accelerometer_d value)
 {
 	return (accelerometer_d) {
-		.x = value.x + gaussian(accelerometer_sd.x),
-		.y = value.y + gaussian(accelerometer_sd.y),
-		.z = value.z + gaussian(accelerometer_sd.z),
-		.q = value.q + gaussian(accelerometer_sd.q),
+		.x = value.x + sensor_noise(accelerometer_sd.x),
+		.y = value.y + sensor_noise(accelerometer_sd.y),
+		.z = value.z + sensor_noise(accelerometer_sd.z),
+		.q = value.q + sensor_noise(accelerometer_sd.q),
 	};
 }
 
 static vec3 vec_noise(vec3 value, vec3 sd)
 {
 	return (vec3) {
-		.x = value.x + gaussian(sd.x),
-		.y = value.y + gaussian(sd.y),
-		.z = value.z + gaussian(sd.z),
+		.x = value.x + sensor_noise(sd.x),
+		.y = value.y + sensor_noise(sd.y),
+		.z = value.z + sensor_noise(sd.z),
 	};
 }
 
 static void update_simulator(void)
 {
 	trace_state("sim", &rocket_state, ", %4.1f kg, %c%c%c\n",
-	       mass,
+	       rocket_mass(current_timestamp()),
 	       engine_burning        ? 'B' : '-',
 	       drogue_chute_deployed ? 'D' : '-',
 	       main_chute_deployed   ? 'M' : '-');
 
-	accelerometer_sensor(quantize_accelerometer(add_accelerometer_noise(accelerometer_measurement(&rocket_state)), 0xfff));
+	accelerometer_sensor(quantize_accelerometer(add_accelerometer_noise(accelerometer_measurement(&gravity, &rocket_state)), 0xfff));
 	if(t % 2000 == 0)
 		gyroscope_sensor(quantize_vec(vec_noise(gyroscope_measurement(&rocket_state), gyroscope_sd), 0xfff));
 	if(t % 100000 == 0)
-		pressure_sensor(quantize(pressure_measurement(&rocket_state) + gaussian(pressure_sd), 0xfff));
+		pressure_sensor(quantize(pressure_measurement(&rocket_state) + sensor_noise(pressure_sd), 0xfff));
 	if(t % 100000 == 25000)
 		magnetometer_sensor(quantize_vec(vec_noise(magnetometer_measurement(&rocket_state), magnetometer_sd), 0xfff));
 	if(t % 100000 == 50000)
@@ -240,15 +292,13 @@ static void update_simulator(void)
 	{
 		trace_printf("Engine burn-out.\n");
 		engine_burning = false;
+		rates_changed = true;
 	}
 	if(last_reported_state() == STATE_PREFLIGHT)
 	{
 		trace_printf("Sending arm signal\n");
 		arm();
 	}
-	if(engine_burning)
-		mass -= FUEL_MASS * DELTA_T_SECONDS / (ENGINE_BURN_TIME / 1e6);
-
 	geodetic pos = ECEF_to_geodetic(rocket_state.pos);
 	if(pos.altitude <= initial_geodetic.altitude)
 	{
@@ -262,15 +312,79 @@ static void update_simulator(void)
 	}
 }
 
+/* Moves the rocket on to the next time step */
+static void advance(void)
+{
+	double next = (t + DELTA_T) / 1e6;
+	if(sim_integrator == INTEGRATE_RK45)
+		adaptive_advance(&integrator, next, &rocket_state);
+	else
+	{
+		integrate_step(sim_integrator, &rocket_state, t / 1e6, DELTA_T_SECONDS, rocket_rates);
+		if(sim_integrator == INTEGRATE_EULER || sim_integrator == INTEGRATE_LEAPFROG)
+			rocket_state.acc = expected_acceleration(next, &rocket_state);
+	}
+}
+
 static void init_rocket_state(struct rocket_state *rocket_state)
 {
 	/* TODO: accept an initial orientation for leaving the tower */
-	mass = ROCKET_EMPTY_MASS + FUEL_MASS;
 	rocket_state->pos = geodetic_to_ECEF(initial_geodetic);
-	rocket_state->rotpos = make_LTP_rotation(initial_geodetic);
+	rocket_state->rotpos = mat3_to_quat(make_LTP_rotation(initial_geodetic));
 	rocket_state->acc = expected_acceleration(0, rocket_state);
 }
 
+/* Everything of the simulator's own a checkpoint carries */
+struct sim_checkpoint {
+	microseconds t;
+	bool engine_ignited, engine_burning;
+	bool drogue_chute_deployed, main_chute_deployed;
+	microseconds engine_ignition_time;
+	struct rocket_state rocket_state;
+	struct adaptive_integrator integrator;
+	struct noise_stream sensor_noise_stream;
+	double sensor_noise_buffer[64];
+	unsigned sensor_noise_left;
+};
+
+static void save_sim_checkpoint(void)
+{
+	static struct sim_checkpoint c;
+	c.t = t;
+	c.engine_ignited = engine_ignited;
+	c.engine_burning = engine_burning;
+	c.drogue_chute_deployed = drogue_chute_deployed;
+	c.main_chute_deployed = main_chute_deployed;
+	c.engine_ignition_time = engine_ignition_time;
+	c.rocket_state = rocket_state;
+	c.integrator = integrator;
+	c.sensor_noise_stream = sensor_noise_stream;
+	memcpy(c.sensor_noise_buffer, sensor_noise_buffer, sizeof(c.sensor_noise_buffer));
+	c.sensor_noise_left = sensor_noise_left;
+	write_checkpoint(&c, sizeof(c));
+}
+
+static bool resume_sim_checkpoint(void)
+{
+	static struct sim_checkpoint c;
+	if(!resume_checkpoint(&c, sizeof(c)))
+		return false;
+	t = c.t;
+	engine_ignited = c.engine_ignited;
+	engine_burning = c.engine_burning;
+	drogue_chute_deployed = c.drogue_chute_deployed;
+	main_chute_deployed = c.main_chute_deployed;
+	engine_ignition_time = c.engine_ignition_time;
+	rocket_state = c.rocket_state;
+	/* all but the rates function, which may load elsewhere this run */
+	c.integrator.rates = integrator.rates;
+	integrator = c.integrator;
+	sensor_noise_stream = c.sensor_noise_stream;
+	memcpy(sensor_noise_buffer, c.sensor_noise_buffer, sizeof(sensor_noise_buffer));
+	sensor_noise_left = c.sensor_noise_left;
+	return true;
+}
+
 int main(int argc, const char *const argv[])
 {
 	parse_trace_args(argc, argv);
@@ -280,16 +394,34 @@ int main(int argc, const char *const argv[])
 		.altitude = 0,
 	};
 
+	noise_stream_init(&sensor_noise_stream, filter_options.seed, UINT64_MAX, 0);
 	init_atmosphere(LAYER0_BASE_TEMPERATURE, LAYER0_BASE_PRESSURE);
+	gravity_field_init(&gravity, sim_gravity, filter_options.gravity_degree, initial_geodetic);
 	init_rocket_state(&rocket_state);
-	init(initial_geodetic, rocket_state.rotpos);
+	set_filter_options(&filter_options);
+	adaptive_init(&integrator, rocket_rates, sim_tolerance, DELTA_T_SECONDS, MAX_STEP);
+	if(!resume_sim_checkpoint())
+	{
+		init(initial_geodetic, quat_to_mat3(rocket_state.rotpos));
+		adaptive_reset(&integrator, 0, &rocket_state);
+	}
 
 	while(last_reported_state() != STATE_RECOVERY)
 	{
-		update_rocket_state_sim(&rocket_state, DELTA_T_SECONDS, expected_acceleration, (double)t);
+		advance();
 		t += DELTA_T;
+		struct rocket_state before = rocket_state;
 		update_simulator();
 		tick(DELTA_T_SECONDS);
+		if(sim_integrator == INTEGRATE_RK45 &&
+		   (rates_changed || memcmp(&before, &rocket_state, sizeof(before))))
+			adaptive_reset(&integrator, current_timestamp(), &rocket_state);
+		rates_changed = false;
+		poll_profile();
+		if(checkpoint_due())
+			save_sim_checkpoint();
 	}
+	if(sim_integrator == INTEGRATE_RK45)
+		trace_printf("%lu integrator steps, %lu rejected\n", integrator.steps, integrator.rejected);
 	return 0;
 }
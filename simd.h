@@ -0,0 +1,63 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <math.h>
+#include <string.h>
+
+/* Portable vectors of doubles using GCC's vector extensions.  The width is
+ * chosen at build time from the instruction set the compiler targets (pass
+ * e.g. ARCH=-mavx2 to make); without any SIMD support a "vector" is a single
+ * double and the kernels built on this degrade to plain scalar code. */
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_WIDTH 4
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_WIDTH 2
+#else
+#define SIMD_WIDTH 1
+#endif
+
+typedef double vdouble __attribute__((vector_size(SIMD_WIDTH * sizeof(double))));
+
+static inline vdouble vload(const double *p)
+{
+	vdouble v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void vstore(double *p, vdouble v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline vdouble vsplat(double x)
+{
+	return (vdouble) {} + x;
+}
+
+static inline vdouble vsqrt(vdouble v)
+{
+#if SIMD_WIDTH == 8
+	return (vdouble) _mm512_sqrt_pd((__m512d) v);
+#elif SIMD_WIDTH == 4
+	return (vdouble) _mm256_sqrt_pd((__m256d) v);
+#elif SIMD_WIDTH == 2
+	return (vdouble) _mm_sqrt_pd((__m128d) v);
+#else
+	return (vdouble) { sqrt(v[0]) };
+#endif
+}
+
+#endif /* SIMD_H */
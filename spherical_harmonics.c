@@ -4,43 +4,13 @@
  * This program is licensed under the GPL version 2 or later.  Please see the
  * file COPYING in the source distribution of this software for license terms.
  */
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "spherical_harmonics.h"
 #include "data_WMM.h"
 
-
-vec3 spherical_harmonic_expansion_mag(const struct spherical_harmonic_coefficient coef[][MAX_DEGREE + 1], const geodetic coord, const int degree);
-
-vec3 magnetic_field(geodetic position)
-{
-    vec3 mag_field;
-    double xp, zp;
-    //convert to spherical
-    double phi = position.latitude;
-    double A = 6378137;
-    double f = 1/298.257223563;
-    double e2 = f*(2-f);
-    double Rc = A/sqrt(1-e2*sin(phi)*sin(phi));
-    double p = (Rc + position.altitude)*cos(phi);
-    double z = (Rc*(1-e2) + position.altitude)*sin(phi);
-    double r = sqrt(p*p + z*z);
-    double phi_prime = asin(z/r);
-    position.latitude = phi_prime;
-    position.altitude = r;
-
-    //make magfield static, and only update when there is a certain change in position/time?
-    
-    mag_field = spherical_harmonic_expansion_mag(magnetic_coefficients, position, MAX_DEGREE); //goes upt to 404
-    //convert magfield into geodetic NED
-    xp = mag_field.x*cos(phi_prime-phi)-mag_field.z*sin(phi_prime-phi);
-    zp = mag_field.x*sin(phi_prime-phi)+mag_field.z*cos(phi_prime-phi);
-    mag_field.x = xp;
-    mag_field.z = zp;
-    //convert to LTP
-    //mag_field.z *= -1;
-    return mag_field;
-}
-
 /*The spherical harmonic formula is:
 
     N             n    _                   _                  _
@@ -67,152 +37,267 @@ Where:
 			{Sqrt(2*(n-m)!/(n+m)!), if m != 0
 		The coefficeints already come normalized so nothing needs to be done to them, but the Associated
 		Legendre Funcions do need to be multiplied by the normalization factor.
+
+With t = sin(lat) and u = cos(lat), the semi-normalized functions follow
+
+	P{m,m} = u * sqrt((2m-1)/(2m)) * P{m-1,m-1}    (the factor is 1 for m = 1)
+	P{n,m} = ((2n-1) * t * P{n-1,m} - sqrt((n-1)^2-m^2) * P{n-2,m}) / sqrt(n^2-m^2)
+
+and their derivatives with latitude follow the same recursions differentiated.
+Working down each order m from P{m,m} needs neither division by u nor any
+array of earlier terms, so all the square roots can be computed in advance.
 */
-/*
-rewrite so that it:
-1.doesn't use as many sqrt (I think cant be written without them, without extensive modification to SHE formula)
-2.handles +-PI/2 latitude gracefully
-3.sequential array access?
-*/
-//apply to multiple applications. Do it by renormalizing leg ftns, or coeffs? I could add a flag that swaps between
-//full and schmidt semi, but I don't like flags. I could pass a normalizing function in?
-vec3 spherical_harmonic_expansion_mag(const struct spherical_harmonic_coefficient coef[][MAX_DEGREE + 1], const geodetic coord, const int degree)
-{//should fail at the poles (latitude = +-90 degree) But I've yet to get it to.
-    int n, m = 0;
-    double x, y, z;
-    const double cos_lon  = cos(coord.longitude);//get sin from cos? pull out? not here,
-    const double sin_lon  = sin(coord.longitude);//even when hard code vals is same speed. why?
-    const double cos_lat  = cos(coord.latitude);
-    const double sin_lat  = sin(coord.latitude);
-    const double a_over_r =  6371200/coord.altitude; //thats radius in m
-    double aoverr_const   = (a_over_r)*(a_over_r);//pow(a/radius_km,2); //find proper name in MIT pdf.
-    double leg, leg_n1 = sqrt(2), leg_m1 = 0, leg_m2;
-    double cos_lon_arr[degree];
-    double sin_lon_arr[degree];
-    double sqrt_val1;
-    vec3 vector   = {0,0,coef[0][0].g};//degree 0
-    cos_lon_arr[0] = 1; //cos(0)
-    sin_lon_arr[0] = 0; //sin(0)
-
-    for(n = 1; n <= degree; ++n)
-    {
-           
-        x = y = z = 0;
-        cos_lon_arr[n] = cos_lon_arr[n-1]*cos_lon - sin_lon_arr[n-1]*sin_lon;
-        sin_lon_arr[n] = cos_lon_arr[n-1]*sin_lon + sin_lon_arr[n-1]*cos_lon;
-        /*m==n*/
-        sqrt_val1 = sqrt((2*n-1)/(2.0*n));
-        leg = cos_lat*leg_n1*sqrt_val1;
-        x  +=   (coef[n][n].g*cos_lon_arr[n] + coef[n][n].h*sin_lon_arr[n]) * -leg_n1*sin_lat*sqrt_val1*n;
-        y  += n*(coef[n][n].g*sin_lon_arr[n] - coef[n][n].h*cos_lon_arr[n]) * leg;
-        z  +=   (coef[n][n].g*cos_lon_arr[n] + coef[n][n].h*sin_lon_arr[n]) * leg;
-        leg_n1 = leg;
-        /*end m==n*/
-        for(m = n-1; m > 0; --m)
-        {
-            
-            leg_m2 = leg_m1;
-            leg_m1 = leg;
-            leg = (sin_lat/cos_lat*(2*m+2)*leg_m1 - sqrt((n-m-1)*(n+m+2))*leg_m2) / sqrt((n-m)*(n+m+1));        
-            x  +=   (coef[n][m].g*cos_lon_arr[m] + coef[n][m].h*sin_lon_arr[m]) * (leg_m1*sqrt((n-m)*(n+m+1)) - m*sin_lat/cos_lat*leg);
-            y  += m*(coef[n][m].g*sin_lon_arr[m] - coef[n][m].h*cos_lon_arr[m]) * leg;
-            //printf("Z: %e, g: %e, leg: %e\n", z, coef[n][m].g, leg);
-            z  +=   (coef[n][m].g*cos_lon_arr[m] + coef[n][m].h*sin_lon_arr[m]) * leg;
-            //printf("%d\n",m);
-            
-
-        }
-        /*m == 0*/
-        
-        sqrt_val1 = sqrt(n*(n+1)*2);
-        leg_m2 = leg_m1;
-        leg_m1 = leg;
-        leg = (sin_lat/cos_lat*2*leg_m1 - sqrt((n-1)*(n+2))*leg_m2) / sqrt_val1;
-        x  += coef[n][m].g * leg_m1*sqrt_val1/2;
-        z  += coef[n][m].g * leg;
-        /*end m == 0*/
-        aoverr_const  *= a_over_r;
-        vector.x  += aoverr_const * x;
-        vector.y  += aoverr_const * y;
-        vector.z  += aoverr_const * z * (n+1);
-    }
-    vector.x  *= -1;
-    vector.y  /=  cos(coord.latitude);
-    vector.z  *= -1;
-    return vector;
+
+/* One degree and order's coefficients, also multiplied by n + 1 for the
+ * radial derivative, with the factors of the recursion that reaches it from
+ * the two degrees before */
+struct spherical_harmonic_term
+{
+	double g, h;
+	double dg, dh;
+	double a, b;
+};
+
+/* Positions evaluated together by spherical_harmonic_potentials() */
+#define SH_LANES 8
+
+bool spherical_harmonic_model_init(struct spherical_harmonic_model *model,
+                                   const struct spherical_harmonic_coefficient *coefficient,
+                                   unsigned stride, unsigned degree, double radius)
+{
+	unsigned n, m;
+	struct spherical_harmonic_term *term;
+
+	model->degree = degree;
+	model->radius = radius;
+	model->term = malloc((degree + 1) * (degree + 2) / 2 * sizeof(*model->term));
+	model->sectoral = malloc((degree + 1) * sizeof(*model->sectoral));
+	if(!model->term || !model->sectoral)
+	{
+		spherical_harmonic_model_free(model);
+		return false;
+	}
+
+	term = model->term;
+	for(m = 0; m <= degree; ++m)
+	{
+		model->sectoral[m] = m > 1 ? sqrt((2.0 * m - 1) / (2.0 * m)) : 1;
+		for(n = m; n <= degree; ++n, ++term)
+		{
+			double root = sqrt((double) n * n - (double) m * m);
+			term->g = coefficient[n * stride + m].g;
+			term->h = coefficient[n * stride + m].h;
+			term->dg = (n + 1) * term->g;
+			term->dh = (n + 1) * term->h;
+			term->a = n > m ? (2.0 * n - 1) / root : 0;
+			term->b = n > m ? sqrt((n - 1.0) * (n - 1.0) - (double) m * m) / root : 0;
+		}
+	}
+	return true;
+}
+
+void spherical_harmonic_model_free(struct spherical_harmonic_model *model)
+{
+	free(model->term);
+	free(model->sectoral);
+	memset(model, 0, sizeof(*model));
+}
+
+/* Both evaluators below carry Q = (a/r)^(n+2) P{n,m} and its derivative
+ * down each order rather than P{n,m} alone, which folds the powers of a/r
+ * into the recursion, and sum the g and h terms separately so that
+ * cos(m lon) and sin(m lon) multiply each order's sums just once. */
+
+struct potential spherical_harmonic_potential(const struct spherical_harmonic_model *model,
+                                              geocentric position)
+{
+	const struct spherical_harmonic_term *term = model->term;
+	double t = sin(position.latitude), u = cos(position.latitude);
+	double cos_lon = cos(position.longitude), sin_lon = sin(position.longitude);
+	double cos_m = 1, sin_m = 0;
+	double q = model->radius / position.radius, qt = q * t, qu = q * u, qq = q * q;
+	double q_mm = qq, dq_mm = 0;
+	double sum = 0, north = 0, east = 0, down = 0;
+	unsigned n, m;
+
+	for(m = 0; m <= model->degree; ++m)
+	{
+		if(m > 0)
+		{
+			double c = cos_m, s = model->sectoral[m] * q;
+			cos_m = c * cos_lon - sin_m * sin_lon;
+			sin_m = c * sin_lon + sin_m * cos_lon;
+			dq_mm = s * (u * dq_mm - t * q_mm);
+			q_mm = s * u * q_mm;
+		}
+		double q1 = q_mm, dq1 = dq_mm, q2 = 0, dq2 = 0;
+		double g = 0, h = 0, dg = 0, dh = 0, ng = 0, nh = 0;
+		for(n = m; ; ++term)
+		{
+			g += term->g * q1;
+			h += term->h * q1;
+			dg += term->dg * q1;
+			dh += term->dh * q1;
+			ng += term->g * dq1;
+			nh += term->h * dq1;
+			if(++n > model->degree)
+				break;
+			double a = term[1].a, b = term[1].b * qq;
+			double next = a * qt * q1 - b * q2;
+			double dnext = a * (qu * q1 + qt * dq1) - b * dq2;
+			q2 = q1;
+			dq2 = dq1;
+			q1 = next;
+			dq1 = dnext;
+		}
+		++term;
+		sum += cos_m * g + sin_m * h;
+		down += cos_m * dg + sin_m * dh;
+		north += cos_m * ng + sin_m * nh;
+		east += m * (cos_m * h - sin_m * g);
+	}
+	return (struct potential) {
+		.value = position.radius * sum,
+		.gradient = { north, east / u, down },
+	};
 }
 
+/* The same for up to SH_LANES positions; every loop over k runs across
+ * them, and each term's coefficients are loaded once for all of them. */
+static void evaluate(const struct spherical_harmonic_model *model,
+                     const geocentric *position, struct potential *potential, unsigned lanes)
+{
+	double t[SH_LANES], u[SH_LANES], qt[SH_LANES], qu[SH_LANES], qq[SH_LANES], q[SH_LANES];
+	double cos_lon[SH_LANES], sin_lon[SH_LANES], cos_m[SH_LANES], sin_m[SH_LANES];
+	double q_mm[SH_LANES], dq_mm[SH_LANES];
+	double q1[SH_LANES], q2[SH_LANES], dq1[SH_LANES], dq2[SH_LANES];
+	double g[SH_LANES], h[SH_LANES], dg[SH_LANES], dh[SH_LANES], ng[SH_LANES], nh[SH_LANES];
+	double sum[SH_LANES], north[SH_LANES], east[SH_LANES], down[SH_LANES];
+	const struct spherical_harmonic_term *term = model->term;
+	unsigned k, n, m;
+
+	for(k = 0; k < lanes; ++k)
+	{
+		t[k] = sin(position[k].latitude);
+		u[k] = cos(position[k].latitude);
+		cos_lon[k] = cos(position[k].longitude);
+		sin_lon[k] = sin(position[k].longitude);
+		cos_m[k] = 1;
+		sin_m[k] = 0;
+		q[k] = model->radius / position[k].radius;
+		qt[k] = q[k] * t[k];
+		qu[k] = q[k] * u[k];
+		qq[k] = q[k] * q[k];
+		q_mm[k] = qq[k];
+		dq_mm[k] = 0;
+		sum[k] = north[k] = east[k] = down[k] = 0;
+	}
 
+	for(m = 0; m <= model->degree; ++m)
+	{
+		if(m > 0)
+			for(k = 0; k < lanes; ++k)
+			{
+				double c = cos_m[k], s = model->sectoral[m] * q[k];
+				cos_m[k] = c * cos_lon[k] - sin_m[k] * sin_lon[k];
+				sin_m[k] = c * sin_lon[k] + sin_m[k] * cos_lon[k];
+				dq_mm[k] = s * (u[k] * dq_mm[k] - t[k] * q_mm[k]);
+				q_mm[k] = s * u[k] * q_mm[k];
+			}
+		for(k = 0; k < lanes; ++k)
+		{
+			q1[k] = q_mm[k];
+			dq1[k] = dq_mm[k];
+			q2[k] = dq2[k] = 0;
+			g[k] = h[k] = dg[k] = dh[k] = ng[k] = nh[k] = 0;
+		}
+		for(n = m; ; ++term)
+		{
+			double tg = term->g, th = term->h, tdg = term->dg, tdh = term->dh;
+			for(k = 0; k < lanes; ++k)
+			{
+				g[k] += tg * q1[k];
+				h[k] += th * q1[k];
+				dg[k] += tdg * q1[k];
+				dh[k] += tdh * q1[k];
+				ng[k] += tg * dq1[k];
+				nh[k] += th * dq1[k];
+			}
+			if(++n > model->degree)
+				break;
+			double a = term[1].a, b = term[1].b;
+			for(k = 0; k < lanes; ++k)
+			{
+				double next = a * qt[k] * q1[k] - b * qq[k] * q2[k];
+				double dnext = a * (qu[k] * q1[k] + qt[k] * dq1[k]) - b * qq[k] * dq2[k];
+				q2[k] = q1[k];
+				dq2[k] = dq1[k];
+				q1[k] = next;
+				dq1[k] = dnext;
+			}
+		}
+		++term;
+		for(k = 0; k < lanes; ++k)
+		{
+			sum[k] += cos_m[k] * g[k] + sin_m[k] * h[k];
+			down[k] += cos_m[k] * dg[k] + sin_m[k] * dh[k];
+			north[k] += cos_m[k] * ng[k] + sin_m[k] * nh[k];
+			east[k] += m * (cos_m[k] * h[k] - sin_m[k] * g[k]);
+		}
+	}
 
-/*
-vec3 spherical_harmonic_epansion_grav(const struct spherical_harmonic_coefficient **coef, point3 coord, int degree)
-{//Yes, this is ugly.
-    //start_counter();
-    if(coord.latitude == 0)
-        coord.latitude = 1e-13; //get better way of fixing.
-    int n, m;
-    double theta, phi, radius; //x, y, z
-    double cos_m_lon, cos_n_lon, sin_m_lon, sin_n_lon, cos_temp;
-    double cos_lon = cos(coord.longitude);
-    double sin_lon = sin(coord.longitude);
-    double cos_lat = cos(coord.latitude);
-    double sin_lat = sin(coord.latitude);
-    double a_over_r =  6378137/coord.radius; //thats radius in m
-    double aoverr_const = 1;//(a_over_r);//\*(a_over_r);//pow(a/radius_km,2); //find proper name in MIT pdf.
-    double leg, leg_n1, leg_m1 = 0, leg_m2;
-    vec3 vector   = {0,0,0};
-    vector.radius = coef[0][0].g; //degree 0
-    cos_n_lon = 1; //cos(0)
-    sin_n_lon = 0; //sin(0)
-    leg_n1 = sqrt(2);
-    //double timer = get_counter();
-    for(n = 1; n <= degree; ++n)//maybe change to foward row for the trig?
-    {
-        theta  = 0;
-        phi    = 0;
-        radius = 0;
-        /\*m==n*\/
-        cos_temp  = cos_n_lon;
-        cos_n_lon = cos_n_lon*cos_lon - sin_n_lon*sin_lon;
-        sin_n_lon = cos_temp *sin_lon + sin_n_lon*cos_lon;
-        cos_m_lon = cos_n_lon;
-        sin_m_lon = sin_n_lon;
-        leg = cos_lat*leg_n1*sqrt((2*n+1)/(2.0*n));
-        theta  +=   (coef[n][n].g*cos_n_lon + coef[n][n].h*sin_n_lon) * -leg_n1*sin_lat*sqrt(((2*n+1)*n)/2.0);//is calc'd to be * -1, but doesn't work. figure out why. has something to do with below?
-        phi    += n*(coef[n][n].g*sin_n_lon - coef[n][n].h*cos_n_lon) * leg;
-        radius +=   (coef[n][n].g*cos_n_lon + coef[n][n].h*sin_n_lon) * leg;
-        leg_n1 = leg;
-        /\*end m==n*\/
-        for(m = n-1; m > 0; --m)
-        {
-            cos_temp  = cos_m_lon;
-            cos_m_lon = cos_m_lon*cos_lon + sin_m_lon*sin_lon;
-            sin_m_lon = sin_m_lon*cos_lon - cos_temp *sin_lon;
-            leg_m2 = leg_m1;
-            leg_m1 = leg;
-            leg    = (sin_lat/cos_lat*(2*m+2)*leg_m1 - sqrt((n-m-1)*(n+m+2))*leg_m2) / sqrt((n-m)*(n+m+1));
-            theta  +=   (coef[n][m].g*cos_m_lon + coef[n][m].h*sin_m_lon) * (m*sin_lat/cos_lat*leg - leg_m1*sqrt((n-m)*(n+m+1)));
-            phi    += m*(coef[n][m].g*sin_m_lon - coef[n][m].h*cos_m_lon) * leg;
-            radius +=   (coef[n][m].g*cos_m_lon + coef[n][m].h*sin_m_lon) * leg;
-        }
-        /\*m == 0*\/
-        leg_m2 = leg_m1;
-        leg_m1 = leg;
-        leg = (sin_lat/cos_lat*2*leg_m1 - sqrt((n-1)*(n+2))*leg_m2) / sqrt(n*(n+1)*2);
-        theta  += coef[n][0].g * -leg_m1*sqrt(n*(n+1)/2.0);
-        radius += coef[n][0].g * leg;
-        /\*end m == 0*\/
-        aoverr_const  *= a_over_r;// pow(a/radius_km, n+2);
-        vector.theta  += aoverr_const * theta;
-        vector.phi    += aoverr_const * phi;
-        vector.radius += aoverr_const * radius * (n+1);
-    }
-    double GM_r2 = 1;//3986004.418e08/((coord.radius*coord.radius));
-    //printf("%e\n",GM_r2);
-    vector.theta  *=  GM_r2;
-    vector.phi    *=  GM_r2/cos(coord.latitude);
-    vector.radius *= -GM_r2;
-    //printf("Cycles: %.0f\n", timer);
-    return vector;
+	for(k = 0; k < lanes; ++k)
+		potential[k] = (struct potential) {
+			.value = position[k].radius * sum[k],
+			.gradient = { north[k], east[k] / u[k], down[k] },
+		};
+}
+
+void spherical_harmonic_potentials(const struct spherical_harmonic_model *model,
+                                   const geocentric *position, struct potential *potential,
+                                   unsigned n)
+{
+	unsigned i;
+	for(i = 0; i < n; i += SH_LANES)
+		evaluate(model, position + i, potential + i, n - i < SH_LANES ? n - i : SH_LANES);
+}
+
+geocentric geodetic_to_geocentric(geodetic position)
+{
+	vec3 ecef = geodetic_to_ECEF(position);
+	double r = vec_abs(ecef);
+	return (geocentric) {
+		.latitude = asin(ecef.z / r),
+		.longitude = position.longitude,
+		.radius = r,
+	};
+}
+
+static struct spherical_harmonic_model magnetic_model;
+static pthread_once_t magnetic_model_once = PTHREAD_ONCE_INIT;
+
+static void init_magnetic_model(void)
+{
+	if(!spherical_harmonic_model_init(&magnetic_model, &magnetic_coefficients[0][0],
+	                                  MAX_DEGREE + 1, MAX_DEGREE, 6371200))
+	{
+		fprintf(stderr, "cannot allocate the magnetic field model\n");
+		abort();
+	}
+}
+
+/* The field in nanotesla, north, east and down in the geodetic frame */
+vec3 magnetic_field(geodetic position)
+{
+	pthread_once(&magnetic_model_once, init_magnetic_model);
+	geocentric spherical = geodetic_to_geocentric(position);
+	vec3 gradient = spherical_harmonic_potential(&magnetic_model, spherical).gradient;
+	/* the field is minus the gradient; turn it from the geocentric
+	 * frame to the geodetic one */
+	double tilt = spherical.latitude - position.latitude;
+	return (vec3) {
+		.x = -gradient.x * cos(tilt) + gradient.z * sin(tilt),
+		.y = -gradient.y,
+		.z = -gradient.x * sin(tilt) - gradient.z * cos(tilt),
+	};
 }
-*/
@@ -7,20 +7,63 @@
 #ifndef SPHERICAL_HARMONICS_H_INCLUDED
 #define SPHERICAL_HARMONICS_H_INCLUDED
 
+#include <stdbool.h>
 #include <math.h>
 #include "coord.h"
 #include "mat.h"
 #include "vec.h"
 
-
-/*struct spherical_harmonic_coefficient
+/* Schmidt semi-normalized coefficients of degree n and order m, as the
+ * model files give them */
+struct spherical_harmonic_coefficient
 {
 	double g;
 	double h;
-};*/
+};
+
+/* A position in earth-centered spherical coordinates: latitude and
+ * longitude in radians, and meters from the center of the earth. */
+typedef struct geocentric {
+	double latitude, longitude, radius;
+} geocentric;
+
+/* A potential and its gradient, the gradient given toward north, east and
+ * down in the spherical frame of the position. */
+struct potential {
+	double value;
+	vec3 gradient;
+};
+
+/* A spherical harmonic expansion of a potential,
+ *
+ *   V = a sum(n = 0..N) (a/r)^(n+1) sum(m = 0..n) (g cos(m lon) + h sin(m lon)) P(n, m, sin(lat))
+ *
+ * with every constant its recursions need worked out once, up front.  The
+ * terms are stored in the order they're used: by order, then degree. */
+struct spherical_harmonic_model
+{
+	unsigned degree;
+	/* a, the model's reference radius */
+	double radius;
+	struct spherical_harmonic_term *term;
+	/* factors relating P(m, m) to P(m - 1, m - 1) */
+	double *sectoral;
+};
+
+/* coefficient[n * stride + m] holds degree n and order m, up to degree */
+bool spherical_harmonic_model_init(struct spherical_harmonic_model *model,
+                                   const struct spherical_harmonic_coefficient *coefficient,
+                                   unsigned stride, unsigned degree, double radius) ATTR_WARN_UNUSED_RESULT;
+void spherical_harmonic_model_free(struct spherical_harmonic_model *model);
+struct potential spherical_harmonic_potential(const struct spherical_harmonic_model *model,
+                                              geocentric position) ATTR_WARN_UNUSED_RESULT;
+/* The potential at n positions at once, sharing each pass over the
+ * coefficients among several of them. */
+void spherical_harmonic_potentials(const struct spherical_harmonic_model *model,
+                                   const geocentric *position, struct potential *potential,
+                                   unsigned n);
+
+geocentric geodetic_to_geocentric(geodetic position) ATTR_WARN_UNUSED_RESULT;
 
 vec3 magnetic_field(geodetic position) ATTR_WARN_UNUSED_RESULT;
-//vec3 spherical_harmonic_expansion_mag (const struct spherical_harmonic_coefficient coef[][MAX_DEGREE], const geodetic coord, const int order) ATTR_WARN_UNUSED_RESULT;
-//vec3 spherical_harmonic_expansion_grav(const struct spherical_harmonic_coefficient **coef, geodetic coord, int degree);
 #endif // SPHERICAL_HARMONICS_H_INCLUDED
-
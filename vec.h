@@ -18,10 +18,78 @@ union vec_array {
 	double component[3];
 };
 
-vec3 vec_add(vec3 a, vec3 b) ATTR_WARN_UNUSED_RESULT;
-vec3 vec_sub(vec3 a, vec3 b) ATTR_WARN_UNUSED_RESULT;
-double vec_dot(vec3 a, vec3 b) ATTR_WARN_UNUSED_RESULT;
-double vec_abs(vec3 v) ATTR_WARN_UNUSED_RESULT;
-vec3 vec_scale(vec3 v, double scale) ATTR_WARN_UNUSED_RESULT;
+/* Many vectors, one array per component */
+struct vec3_array
+{
+	double *x, *y, *z;
+};
+
+/* Everything here is small enough to inline, and is defined in the header
+ * so it will be whether or not the toolchain can optimize across files. */
+static inline vec3 vec_add(vec3 a, vec3 b) ATTR_WARN_UNUSED_RESULT;
+static inline vec3 vec_sub(vec3 a, vec3 b) ATTR_WARN_UNUSED_RESULT;
+static inline double vec_dot(vec3 a, vec3 b) ATTR_WARN_UNUSED_RESULT;
+static inline double vec_abs(vec3 v) ATTR_WARN_UNUSED_RESULT;
+static inline vec3 vec_scale(vec3 v, double scale) ATTR_WARN_UNUSED_RESULT;
+/* scale * x + y, BLAS's axpy */
+static inline vec3 vec_axpy(double scale, vec3 x, vec3 y) ATTR_WARN_UNUSED_RESULT;
+
+static inline vec3 vec_add(vec3 a, vec3 b)
+{
+	return (vec3) {
+		.x = a.x + b.x,
+		.y = a.y + b.y,
+		.z = a.z + b.z
+	};
+}
+
+static inline vec3 vec_sub(vec3 a, vec3 b)
+{
+	return (vec3) {
+		.x = a.x - b.x,
+		.y = a.y - b.y,
+		.z = a.z - b.z
+	};
+}
+
+static inline double vec_dot(vec3 a, vec3 b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline double vec_abs(vec3 v)
+{
+	return sqrt(vec_dot(v, v));
+}
+
+static inline vec3 vec_scale(vec3 v, double scale)
+{
+	return (vec3) {
+		.x = scale*v.x,
+		.y = scale*v.y,
+		.z = scale*v.z
+	};
+}
+
+static inline vec3 vec_axpy(double scale, vec3 x, vec3 y)
+{
+	return (vec3) {
+		.x = scale*x.x + y.x,
+		.y = scale*x.y + y.y,
+		.z = scale*x.z + y.z
+	};
+}
+
+static inline vec3 vec3_array_get(const struct vec3_array *a, unsigned i)
+{
+	return (vec3) { a->x[i], a->y[i], a->z[i] };
+}
+
+static inline void vec3_array_set(struct vec3_array *a, unsigned i, vec3 v)
+{
+	a->x[i] = v.x;
+	a->y[i] = v.y;
+	a->z[i] = v.z;
+}
 
 #endif /* VEC_H */
@@ -0,0 +1,135 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "workers.h"
+
+static pthread_t *threads;
+static unsigned thread_count;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+
+/* Everything but next_block is protected by lock. */
+static struct {
+	work_fn *fn;
+	void *arg;
+	unsigned count, blocks;
+	unsigned next_block;
+	unsigned generation;
+	unsigned finished;
+	bool stopping;
+} job;
+
+static void run_blocks(void)
+{
+	unsigned block;
+	while((block = __atomic_fetch_add(&job.next_block, 1, __ATOMIC_RELAXED)) < job.blocks)
+	{
+		unsigned begin = block * WORK_BLOCK;
+		unsigned end = begin + WORK_BLOCK < job.count ? begin + WORK_BLOCK : job.count;
+		job.fn(job.arg, begin, end, block);
+	}
+}
+
+/* generation is the last job the new thread should consider already run */
+static void *worker(void *generation)
+{
+	unsigned seen = (uintptr_t) generation;
+	pthread_mutex_lock(&lock);
+	for(;;)
+	{
+		while(job.generation == seen && !job.stopping)
+			pthread_cond_wait(&job_ready, &lock);
+		if(job.stopping)
+			break;
+		seen = job.generation;
+		pthread_mutex_unlock(&lock);
+
+		run_blocks();
+
+		pthread_mutex_lock(&lock);
+		if(++job.finished == thread_count)
+			pthread_cond_signal(&job_done);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+bool workers_start(unsigned count)
+{
+	workers_stop();
+	if(!count)
+		return true;
+	threads = calloc(count, sizeof(*threads));
+	if(!threads)
+		return false;
+	for(thread_count = 0; thread_count < count; ++thread_count)
+		if(pthread_create(&threads[thread_count], NULL, worker, (void *) (uintptr_t) job.generation))
+		{
+			workers_stop();
+			return false;
+		}
+	return true;
+}
+
+void workers_stop(void)
+{
+	unsigned i;
+	pthread_mutex_lock(&lock);
+	job.stopping = true;
+	pthread_cond_broadcast(&job_ready);
+	pthread_mutex_unlock(&lock);
+	for(i = 0; i < thread_count; ++i)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	threads = NULL;
+	thread_count = 0;
+	job.stopping = false;
+}
+
+unsigned workers_running(void)
+{
+	return thread_count;
+}
+
+void workers_run(work_fn *fn, void *arg, unsigned count)
+{
+	unsigned blocks = work_blocks(count);
+	unsigned block;
+
+	if(thread_count == 0 || blocks <= 1)
+	{
+		for(block = 0; block < blocks; ++block)
+		{
+			unsigned begin = block * WORK_BLOCK;
+			fn(arg, begin, begin + WORK_BLOCK < count ? begin + WORK_BLOCK : count, block);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	job.fn = fn;
+	job.arg = arg;
+	job.count = count;
+	job.blocks = blocks;
+	job.next_block = 0;
+	job.finished = 0;
+	++job.generation;
+	pthread_cond_broadcast(&job_ready);
+	pthread_mutex_unlock(&lock);
+
+	run_blocks();
+
+	pthread_mutex_lock(&lock);
+	while(job.finished < thread_count)
+		pthread_cond_wait(&job_done, &lock);
+	pthread_mutex_unlock(&lock);
+}
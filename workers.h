@@ -0,0 +1,36 @@
+/* Copyright © 2010 Portland State Aerospace Society
+ * See version control history for detailed authorship information.
+ *
+ * This program is licensed under the GPL version 2 or later.  Please see the
+ * file COPYING in the source distribution of this software for license terms.
+ */
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdbool.h>
+#include "compiler.h"
+
+/* A persistent pool of threads for loops over the particle set.  A job's
+ * index range is cut into fixed blocks of WORK_BLOCK elements, which the
+ * calling thread and the workers claim until none are left.  Since the block
+ * boundaries never depend on the number of threads, a reduction that keeps
+ * one partial result per block and combines them in block order gives
+ * bit-identical results however many threads ran it. */
+
+#define WORK_BLOCK 256
+
+typedef void work_fn(void *arg, unsigned begin, unsigned end, unsigned block);
+
+static inline unsigned work_blocks(unsigned count)
+{
+	return (count + WORK_BLOCK - 1) / WORK_BLOCK;
+}
+
+/* Starts the given number of threads in addition to the caller's. */
+bool workers_start(unsigned threads) ATTR_WARN_UNUSED_RESULT;
+void workers_stop(void);
+unsigned workers_running(void);
+/* Calls fn on every block of [0, count) and waits for all of them. */
+void workers_run(work_fn *fn, void *arg, unsigned count);
+
+#endif /* WORKERS_H */